@@ -603,6 +603,23 @@ public:
 };
 
 
+/** The curve a source's gain follows while fading. */
+enum class FadeShape {
+    /** Changes the gain amplitude at a constant rate. */
+    Linear,
+    /**
+     * Changes the gain by a constant number of decibels per second. This is
+     * the most perceptually consistent, though gains of 0 are reached by
+     * dropping from -80dB at the end of the fade.
+     */
+    Exponential,
+    /**
+     * Changes the gain amplitude slowly at the start and end, and fastest in
+     * the middle.
+     */
+    SCurve
+};
+
 enum class DistanceModel {
     InverseClamped  = AL_INVERSE_DISTANCE_CLAMPED,
     LinearClamped   = AL_LINEAR_DISTANCE_CLAMPED,
@@ -672,6 +689,47 @@ public:
      */
     std::chrono::milliseconds getAsyncWakeInterval() const;
 
+    /**
+     * Sets how far ahead of playback streaming sources decode, on a separate
+     * worker thread. The background thread then only has to queue ready
+     * audio, so a slow decode or read doesn't make the stream underrun. A
+     * value of 0 decodes each chunk as it's queued instead. This applies to
+     * streams started afterward. The default is 250 milliseconds.
+     */
+    void setStreamDecodeAhead(std::chrono::milliseconds ahead);
+
+    /** Retrieves how far ahead of playback streaming sources decode. */
+    std::chrono::milliseconds getStreamDecodeAhead() const;
+
+    /**
+     * Enables or disables callback streaming. When enabled, and the
+     * AL_SOFT_callback_buffer extension is supported, streaming sources
+     * started afterward have the mixer pull audio straight from the decoded
+     * chunks, instead of queueing them through a series of buffers. This
+     * removes the chunk length and background thread's wake interval from
+     * the playback latency. Streams always decode ahead in this mode. The
+     * default is disabled.
+     */
+    void setCallbackStreaming(bool enable);
+
+    /** Retrieves whether callback streaming is enabled. */
+    bool getCallbackStreaming() const;
+
+    /**
+     * Retrieves the total number of stream underruns from this context's
+     * sources (see \c Source::getUnderrunCount).
+     */
+    uint64_t getUnderrunCount() const;
+
+    /**
+     * Retrieves how well streams reuse the context's pool of AL buffers and
+     * decode memory, as the number of buffers and memory blocks taken from
+     * the pool, and the number that had to be newly created. Streams started
+     * with the same chunk length, queue size and sample format reuse each
+     * other's.
+     */
+    std::pair<uint64_t,uint64_t> getStreamPoolStats() const;
+
     // Functions below require the context to be current
 
     /**
@@ -679,6 +737,37 @@ public:
      */
     SharedPtr<Decoder> createDecoder(StringView name);
 
+    /**
+     * Creates a decoder that reads the given decoder's audio through a stream
+     * shared with every other decoder created from it, so the audio is only
+     * decoded once however many sources play it. Each returned decoder keeps
+     * its own position within the few seconds of audio the stream holds, and
+     * starts from the oldest audio still held. One that falls further behind
+     * skips ahead, and seeking is limited to the held audio.
+     *
+     * The given decoder should not be read from directly afterward.
+     */
+    SharedPtr<Decoder> createSharedDecoder(SharedPtr<Decoder> decoder);
+
+    /**
+     * Creates a decoder that starts decoding the given audio file or resource
+     * name in the background, so a source can start playing it without first
+     * waiting on the decoder. The audio is decoded from its start, into
+     * queue_size chunks of chunk_len sample frames.
+     *
+     * Passing the returned decoder to \c Source::play with the same chunk_len
+     * starts playback with the already decoded chunks. Otherwise, or if it's
+     * read from or seeked first, it behaves as a normal decoder.
+     */
+    SharedPtr<Decoder> prepareStream(StringView name, ALsizei chunk_len, ALsizei queue_size);
+    /**
+     * Creates a decoder that starts decoding the given decoder's audio in the
+     * background, from its current position. See \c prepareStream for
+     * details.
+     */
+    SharedPtr<Decoder> prepareStream(SharedPtr<Decoder> decoder, ALsizei chunk_len,
+                                     ALsizei queue_size);
+
     /**
      * Queries if the channel configuration and sample type are supported by
      * the context.
@@ -830,6 +919,18 @@ public:
      */
     void setDistanceModel(DistanceModel model);
 
+    /**
+     * Enables or disables distance culling. When enabled, looping buffer
+     * sources with an estimated gain at or below the threshold, from distance
+     * attenuation and the source and group gains, release their voice and
+     * keep tracking their play position virtually. They get a voice back
+     * during an update once their estimated gain goes above the threshold.
+     * Culled sources still report as playing. Disabled by default.
+     */
+    void setDistanceCulling(bool enable, ALfloat threshold=0.0f);
+    bool getDistanceCulling() const;
+    ALfloat getDistanceCullingThreshold() const;
+
     /** Updates the context and all sources belonging to this context. */
     void update();
 };
@@ -878,6 +979,19 @@ public:
 };
 
 
+/**
+ * How a buffer that's at its instance limit makes room for another source
+ * trying to play it.
+ */
+enum class InstanceSteal {
+    /** Stops the source that started playing the buffer the longest ago. */
+    Oldest,
+    /** Stops the source with the lowest estimated gain at the listener. */
+    Quietest,
+    /** Rejects the new play, leaving the source as it was. */
+    Reject
+};
+
 class ALURE_API Buffer {
     MAKE_PIMPL(Buffer, BufferImpl)
 
@@ -931,6 +1045,28 @@ public:
      * getSources().size().
      */
     size_t getSourceCount() const;
+
+    /**
+     * Limits the number of sources that may play the buffer at once. When a
+     * source tries to play the buffer with the limit reached, the steal rule
+     * decides if another source is stopped to make room (which is reported
+     * with \c MessageHandler::sourceForceStopped), or if the play is rejected.
+     * A limit of 0, the default, allows any number of sources.
+     */
+    void setInstanceLimit(ALuint limit, InstanceSteal steal=InstanceSteal::Oldest);
+    /** Retrieves the number of sources that may play the buffer at once. */
+    ALuint getInstanceLimit() const;
+    /** Retrieves how the buffer makes room when its instance limit is reached. */
+    InstanceSteal getInstanceSteal() const;
+
+    /**
+     * Sets the minimum time between sources starting to play the buffer.
+     * Attempts to play it sooner after the last accepted start are rejected,
+     * leaving the source as it was. A delay of 0, the default, disables this.
+     */
+    void setRetriggerDelay(std::chrono::milliseconds delay);
+    /** Retrieves the minimum time between sources starting to play the buffer. */
+    std::chrono::milliseconds getRetriggerDelay() const;
 };
 
 
@@ -977,6 +1113,65 @@ public:
      */
     void play(SharedFuture<Buffer> future_buffer);
 
+    /**
+     * Plays the source using a buffer, starting at the given device clock
+     * time (as given by \c Device::getClockTime). A start time that has
+     * already passed will begin playing immediately.
+     *
+     * If the AL_SOFT_source_start_delay and ALC_SOFT_device_clock extensions
+     * are available, the device starts the source on the given sample.
+     * Otherwise the context's background thread starts it, which is only as
+     * accurate as the device's update period. Until then the source reports
+     * as playing, and pausing it cancels the scheduled start, leaving it
+     * paused at the beginning.
+     */
+    void playAt(Buffer buffer, std::chrono::nanoseconds start_time);
+    /**
+     * Plays the source by asynchronously streaming audio from a decoder,
+     * starting at the given device clock time. The first chunks are queued
+     * right away, and playback begins as with \c playAt(Buffer,std::chrono::nanoseconds).
+     */
+    void playAt(SharedPtr<Decoder> decoder, ALsizei chunk_len, ALsizei queue_size,
+                std::chrono::nanoseconds start_time);
+
+    /**
+     * Queues a decoder to continue streaming from once the current stream's
+     * decoder ends, for gapless playlists. If the decoder has the same sample
+     * rate, channel configuration, and sample type as the current one, it's
+     * joined sample-exactly. Otherwise it's started as soon as the current
+     * stream finishes playing. Multiple decoders can be queued, and are played
+     * in order. Looping streams never end, so they never reach queued
+     * decoders. If the stream already ended, this plays the decoder right
+     * away.
+     *
+     * After a seamless change, the reported offset is for the new decoder, and
+     * stays at 0 until the previous decoder's remaining audio has played.
+     * Setting the offset applies to the decoder being decoded.
+     */
+    void queueNext(SharedPtr<Decoder> decoder);
+
+    /**
+     * Sets the latency range for adaptively sizing the queue of streams played
+     * by this source. The number of queued chunks grows when the queue nearly
+     * runs out, or refills arrive irregularly, and shrinks again after a few
+     * calm seconds, keeping the queued time within this range. The queue_size
+     * given to \c play is the most chunks that can be queued, and at least 2
+     * are always queued. A max_latency of 0, the default, disables adapting,
+     * always queuing queue_size chunks. This also applies to the current
+     * stream.
+     */
+    void setStreamLatencyRange(std::chrono::milliseconds min_latency,
+                               std::chrono::milliseconds max_latency);
+    /** Retrieves the latency range for adaptively sizing stream queues. */
+    std::pair<std::chrono::milliseconds,std::chrono::milliseconds> getStreamLatencyRange() const;
+
+    /**
+     * Retrieves the amount of audio the current stream aims to keep queued,
+     * which is the latency of new audio from the decoder. This is 0 when not
+     * streaming.
+     */
+    std::chrono::nanoseconds getStreamLatency() const;
+
     /**
      * Stops playback, releasing the buffer or decoder reference. Any pending
      * playback from a future buffer is canceled.
@@ -1005,6 +1200,35 @@ public:
      */
     void fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration);
 
+    /**
+     * Fades the source from its current fade gain to the specified gain over
+     * the given duration, following the given shape. This gain is in addition
+     * to the base gain, and must be between 0 and 1 inclusive, with 1 being
+     * no change from the base gain. The source keeps playing once the fade
+     * completes, and the gain remains until the source stops.
+     *
+     * A new fade, including \c fadeOutToStop, replaces any fade in progress,
+     * starting from the gain it had reached. Fading is updated during calls
+     * to \c Context::update.
+     */
+    void fadeTo(ALfloat gain, std::chrono::milliseconds duration,
+                FadeShape shape=FadeShape::Exponential);
+
+    /**
+     * Silences the source and fades it back to its base gain over the given
+     * duration. Call this after starting playback, since starting playback
+     * again cancels the fade.
+     */
+    void fadeIn(std::chrono::milliseconds duration, FadeShape shape=FadeShape::Exponential);
+
+    /**
+     * Fades this source out and stops it, while fading the other source in
+     * from silence, over the same time span. The other source should already
+     * be playing or pending.
+     */
+    void crossfadeTo(Source other, std::chrono::milliseconds duration,
+                     FadeShape shape=FadeShape::Exponential);
+
     /** Pauses the source if it is playing. */
     void pause();
 
@@ -1026,6 +1250,13 @@ public:
      */
     bool isPlayingOrPending() const;
 
+    /**
+     * Retrieves the number of times a stream played by this source ran out of
+     * queued audio while playing, causing an audible gap. Buffer sources never
+     * underrun.
+     */
+    uint64_t getUnderrunCount() const;
+
     /**
      * Sets this source as a child of the given source group. The given source
      * group's parameters will influence this and all other sources that belong
@@ -1052,6 +1283,11 @@ public:
      * Sets the source's offset, in sample frames. If the source is playing or
      * paused, it will go to that offset immediately, otherwise the source will
      * start at the specified offset the next time it's played.
+     *
+     * A streaming source seeks on the background thread, so this returns
+     * without waiting on the decoder. If it's called again before the seek
+     * happens, only the latest offset is used, and a failed seek leaves the
+     * stream playing where it was.
      */
     void setOffset(uint64_t offset);
     /**
@@ -1463,6 +1699,36 @@ public:
      * indicates the end of the audio.
      */
     virtual ALuint read(ALvoid *ptr, ALuint count) noexcept = 0;
+
+    /**
+     * Retrieves all of the decoder's sample frames, if they're already in
+     * memory in the decoder's sample type and channel configuration (e.g.
+     * uncompressed audio in a memory-mapped file). Buffers are then loaded
+     * from it directly, rather than reading into a temporary copy. The view
+     * must remain valid for the lifetime of the decoder. The default returns
+     * an empty view, meaning the samples need to be read.
+     */
+    virtual ArrayView<ALbyte> getDirectData() noexcept;
+
+    /**
+     * Creates a new decoder for the same audio, positioned at the given
+     * sample frame offset. It has the same format as this decoder, and can
+     * decode alongside it on another thread, which lets long buffers be
+     * loaded in parallel pieces. This may be called from other threads while
+     * this decoder is in use. The default returns an empty handle, meaning
+     * the decoder can't be cloned.
+     */
+    virtual SharedPtr<Decoder> cloneAt(uint64_t pos) const noexcept;
+};
+
+/** How a decoder factory recognizes the start of a file. */
+enum class SignatureMatch {
+    /** The file isn't in a format the factory decodes. */
+    NoMatch,
+    /** The factory can't tell from the start of the file. */
+    Unknown,
+    /** The file starts with the signature of a format the factory decodes. */
+    Match
 };
 
 /**
@@ -1482,14 +1748,25 @@ public:
      * \return nullptr if a decoder can't be created from the file.
      */
     virtual SharedPtr<Decoder> createDecoder(UniquePtr<std::istream> &file) noexcept = 0;
+
+    /**
+     * Checks the start of a file against the signatures of the formats this
+     * factory decodes, so factories that can't decode it don't have to read
+     * and reject it. The header holds the first 64 bytes of the file, or the
+     * whole file if it's shorter. Factories returning Match are tried before
+     * those returning Unknown, and those returning NoMatch aren't tried. The
+     * default returns Unknown.
+     */
+    virtual SignatureMatch checkSignature(ArrayView<ALbyte> header) const noexcept;
 };
 
 /**
  * Registers a decoder factory for decoding audio. Registered factories are
  * used in lexicographical order, e.g. if Factory1 is registered with name1 and
  * Factory2 is registered with name2, Factory1 will be used before Factory2 if
- * name1 < name2. Internal decoder factories are always used after registered
- * ones.
+ * name1 < name2, unless only one of them matches the file's signature (see
+ * DecoderFactory::checkSignature). Internal decoder factories are always used
+ * after registered ones.
  *
  * Alure retains a reference to the DecoderFactory instance and will release it
  * (destructing the object) when the library unloads.
@@ -1536,6 +1813,15 @@ public:
 
     /** Opens a read-only binary file for the given name. */
     virtual UniquePtr<std::istream> openFile(const String &name) noexcept = 0;
+
+    /**
+     * Called with the names of files that are about to be opened together,
+     * such as by Context::precacheBuffersAsync, in the order they'll be
+     * opened. Implementations may start reading them in the background, so
+     * the reads overlap each other and the decoding. The default does
+     * nothing.
+     */
+    virtual void prefetchFiles(ArrayView<StringView> names) noexcept;
 };
 
 
@@ -1583,6 +1869,17 @@ public:
      */
     virtual void sourceForceStopped(Source source) noexcept;
 
+    /**
+     * Called when the given source's stream ran out of queued audio while
+     * playing, and had to be restarted once more was decoded. The gap is an
+     * upper bound on the silence, measured by the background thread, so it
+     * includes up to one wake interval of detection delay. Underruns are
+     * detected asynchronously, and reported upon a call to Context::update.
+     * Several underruns between updates are reported together, with their
+     * gaps added up.
+     */
+    virtual void streamUnderrun(Source source, std::chrono::nanoseconds gap) noexcept;
+
     /**
      * Called when a new buffer is about to be created and loaded. May be
      * called asynchronously for buffers being loaded asynchronously.
@@ -3,10 +3,14 @@
 
 #include "buffer.h"
 
+#include <system_error>
+#include <functional>
 #include <stdexcept>
 #include <cstring>
+#include <thread>
 
 #include "context.h"
+#include "source.h"
 
 namespace {
 
@@ -76,6 +80,11 @@ const struct {
     { SampleType::Mulaw, AL::EXT_MULAW, MulawFormats },
 };
 
+// Buffers are decoded in parallel pieces of at least this many sample frames,
+// when the decoder can be cloned. Shorter reads aren't worth the threads.
+constexpr ALuint MinPieceFrames = 1u<<18;
+constexpr size_t MaxDecodeThreads = 8;
+
 } // namespace
 
 namespace alure {
@@ -118,20 +127,33 @@ void BufferImpl::cleanup()
 
 void BufferImpl::load(ALuint frames, ALenum format, SharedPtr<Decoder> decoder, ContextImpl *ctx)
 {
-    Vector<ALbyte> data(FramesToBytes(frames, mChannelConfig, mSampleType));
-
-    ALuint got = decoder->read(data.data(), frames);
-    if(got > 0)
+    // Use the decoder's samples in place if it has them in memory, rather
+    // than reading a copy.
+    Vector<ALbyte> data;
+    ArrayView<ALbyte> samples = decoder->getDirectData();
+    size_t direct_frames = samples.size() / FramesToBytes(1, mChannelConfig, mSampleType);
+    if(direct_frames > 0)
     {
-        frames = got;
-        data.resize(FramesToBytes(frames, mChannelConfig, mSampleType));
+        frames = static_cast<ALuint>(std::min<size_t>(frames, direct_frames));
+        samples = samples.slice(0, FramesToBytes(frames, mChannelConfig, mSampleType));
     }
     else
     {
-        ALbyte silence = 0;
-        if(mSampleType == SampleType::UInt8) silence = -128;
-        else if(mSampleType == SampleType::Mulaw) silence = 127;
-        std::fill(data.begin(), data.end(), silence);
+        data.resize(FramesToBytes(frames, mChannelConfig, mSampleType));
+        ALuint got = ReadBufferFrames(*decoder, data.data(), frames, mChannelConfig, mSampleType);
+        if(got > 0)
+        {
+            frames = got;
+            data.resize(FramesToBytes(frames, mChannelConfig, mSampleType));
+        }
+        else
+        {
+            ALbyte silence = 0;
+            if(mSampleType == SampleType::UInt8) silence = -128;
+            else if(mSampleType == SampleType::Mulaw) silence = 127;
+            std::fill(data.begin(), data.end(), silence);
+        }
+        samples = data;
     }
 
     std::pair<uint64_t,uint64_t> loop_pts = decoder->getLoopPoints();
@@ -144,10 +166,10 @@ void BufferImpl::load(ALuint frames, ALenum format, SharedPtr<Decoder> decoder,
     }
 
     ctx->send(&MessageHandler::bufferLoading,
-        mName, mChannelConfig, mSampleType, mFrequency, data
+        mName, mChannelConfig, mSampleType, mFrequency, samples
     );
 
-    alBufferData(mId, format, data.data(), static_cast<ALsizei>(data.size()), mFrequency);
+    alBufferData(mId, format, samples.data(), static_cast<ALsizei>(samples.size()), mFrequency);
     if(ctx->hasExtension(AL::SOFT_loop_points))
     {
         ALint pts[2]{(ALint)loop_pts.first, (ALint)loop_pts.second};
@@ -222,12 +244,98 @@ std::pair<ALuint,ALuint> BufferImpl::getLoopPoints() const
     return std::make_pair(pts[0], pts[1]);
 }
 
+DECL_THUNK2(void, Buffer, setInstanceLimit,, ALuint, InstanceSteal)
+void BufferImpl::setInstanceLimit(ALuint limit, InstanceSteal steal)
+{
+    mInstanceLimit = limit;
+    mInstanceSteal = steal;
+}
+
+DECL_THUNK1(void, Buffer, setRetriggerDelay,, std::chrono::milliseconds)
+void BufferImpl::setRetriggerDelay(std::chrono::milliseconds delay)
+{
+    if(delay.count() < 0)
+        throw std::out_of_range("Retrigger delay out of range");
+    mRetriggerDelay = delay;
+}
+
+// Applies the instance policies for the given source starting to play the
+// buffer, stopping other sources as needed. Returns false if the source isn't
+// allowed to play it.
+bool BufferImpl::admitSource(SourceImpl *source)
+{
+    std::chrono::nanoseconds now{};
+    if(mRetriggerDelay.count() > 0)
+    {
+        now = mContext.getDevice().getHandle()->getClockTime();
+        if(mLastStartTime != std::chrono::nanoseconds::min() && now-mLastStartTime < mRetriggerDelay)
+            return false;
+    }
+
+    if(mInstanceLimit > 0)
+    {
+        // A source restarting the buffer doesn't take another instance, and
+        // neither do sources that finished but haven't been reaped yet.
+        size_t count = std::count_if(mSources.cbegin(), mSources.cend(),
+            [source](const Source &src) -> bool
+            {
+                SourceImpl *cur = src.getHandle();
+                return cur != source && !cur->hasFinished();
+            }
+        );
+        if(count >= mInstanceLimit)
+        {
+            if(mInstanceSteal == InstanceSteal::Reject)
+                return false;
+
+            const SourcePropStore &props = mContext.getSourceProps();
+            const Vector3 &listener = mContext.getListenerImpl().getPosition();
+            const DistanceModel model = mContext.getDistanceModel();
+            while(count >= mInstanceLimit)
+            {
+                SourceImpl *victim = nullptr;
+                ALfloat victim_gain = 0.0f;
+                for(const Source &src : mSources)
+                {
+                    SourceImpl *cur = src.getHandle();
+                    if(cur == source || cur->hasFinished()) continue;
+                    if(mInstanceSteal == InstanceSteal::Oldest)
+                    {
+                        // Sources are added as they start, so the first is the
+                        // oldest.
+                        victim = cur;
+                        break;
+                    }
+                    ALfloat gain = props.calcGain(cur->getPropIndex(), listener, model);
+                    if(!victim || gain < victim_gain)
+                    {
+                        victim = cur;
+                        victim_gain = gain;
+                    }
+                }
+                if(!victim) break;
+
+                victim->stop();
+                mContext.send(&MessageHandler::sourceForceStopped, Source(victim));
+                --count;
+            }
+        }
+    }
+
+    if(mRetriggerDelay.count() > 0)
+        mLastStartTime = now;
+    return true;
+}
+
 DECL_THUNK0(ALuint, Buffer, getFrequency, const)
 DECL_THUNK0(ChannelConfig, Buffer, getChannelConfig, const)
 DECL_THUNK0(SampleType, Buffer, getSampleType, const)
 DECL_THUNK0(Vector<Source>, Buffer, getSources, const)
 DECL_THUNK0(StringView, Buffer, getName, const)
 DECL_THUNK0(size_t, Buffer, getSourceCount, const)
+DECL_THUNK0(ALuint, Buffer, getInstanceLimit, const)
+DECL_THUNK0(InstanceSteal, Buffer, getInstanceSteal, const)
+DECL_THUNK0(std::chrono::milliseconds, Buffer, getRetriggerDelay, const)
 
 
 ALURE_API const char *GetSampleTypeName(SampleType type)
@@ -346,4 +454,77 @@ ALenum GetFormat(ChannelConfig chans, SampleType type)
     return AL_NONE;
 }
 
+ALuint ReadBufferFrames(Decoder &decoder, ALbyte *dst, ALuint frames, ChannelConfig chans,
+                        SampleType type)
+{
+    size_t numpieces = std::min<size_t>(std::thread::hardware_concurrency(), MaxDecodeThreads);
+    numpieces = std::min<size_t>(numpieces, frames / MinPieceFrames);
+
+    // Check that the decoder can be cloned before setting up the pieces. The
+    // clone reads the first piece.
+    SharedPtr<Decoder> first;
+    if(numpieces >= 2)
+        first = decoder.cloneAt(0);
+    if(!first)
+    {
+        decoder.seek(0);
+        return decoder.read(dst, frames);
+    }
+
+    struct Piece {
+        ALuint mStart, mCount;
+        ALuint mGot{0};
+        bool mDone{false};
+    };
+    Vector<Piece> pieces(numpieces);
+    for(size_t i = 0;i < numpieces;++i)
+    {
+        pieces[i].mStart = static_cast<ALuint>(uint64_t{frames} * i / numpieces);
+        pieces[i].mCount = static_cast<ALuint>(uint64_t{frames} * (i+1) / numpieces) -
+                           pieces[i].mStart;
+    }
+
+    // Other clones read the rest of the pieces on their own threads.
+    auto decode_piece = [&decoder,dst,chans,type](Piece &piece) -> void
+    {
+        SharedPtr<Decoder> clone = decoder.cloneAt(piece.mStart);
+        if(!clone) return;
+        piece.mGot = clone->read(dst + FramesToBytes(piece.mStart, chans, type), piece.mCount);
+        piece.mDone = true;
+    };
+    Vector<std::thread> threads;
+    threads.reserve(numpieces-1);
+    try {
+        for(size_t i = 1;i < numpieces;++i)
+            threads.emplace_back(decode_piece, std::ref(pieces[i]));
+    }
+    catch(std::system_error&) {
+        // Pieces without a thread get read below, like ones that couldn't be
+        // cloned.
+    }
+    pieces[0].mGot = first->read(dst, pieces[0].mCount);
+    pieces[0].mDone = true;
+    first = nullptr;
+    for(auto &thrd : threads)
+        thrd.join();
+
+    // Stitch the pieces together up to the first one that ended early. Any
+    // the clones couldn't read, the decoder reads after seeking to them.
+    ALuint total = 0;
+    for(Piece &piece : pieces)
+    {
+        if(!piece.mDone)
+        {
+            if(!decoder.seek(piece.mStart))
+                break;
+            piece.mGot = decoder.read(dst + FramesToBytes(piece.mStart, chans, type),
+                                      piece.mCount);
+        }
+        total += piece.mGot;
+        if(piece.mGot < piece.mCount)
+            break;
+    }
+    return total;
+}
+
 } // namespace alure
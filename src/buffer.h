@@ -9,6 +9,14 @@ namespace alure {
 
 ALenum GetFormat(ChannelConfig chans, SampleType type);
 
+// Reads up to frames sample frames from the start of the decoder into dst,
+// returning how many were read, the same as a buffer using the decoder's
+// direct data holds. A decoder that can't seek back is read from where it is.
+// Long reads are split into pieces decoded at once on several threads, if the
+// decoder can be cloned.
+ALuint ReadBufferFrames(Decoder &decoder, ALbyte *dst, ALuint frames, ChannelConfig chans,
+                        SampleType type);
+
 class BufferImpl {
     ContextImpl &mContext;
     ALuint mId;
@@ -19,6 +27,11 @@ class BufferImpl {
 
     Vector<Source> mSources;
 
+    ALuint mInstanceLimit{0};
+    InstanceSteal mInstanceSteal{InstanceSteal::Oldest};
+    std::chrono::milliseconds mRetriggerDelay{0};
+    std::chrono::nanoseconds mLastStartTime{std::chrono::nanoseconds::min()};
+
     const String mName;
     size_t mNameHash;
 
@@ -56,6 +69,17 @@ public:
 
     Vector<Source> getSources() const { return mSources; }
 
+    bool hasInstancePolicy() const
+    { return mInstanceLimit > 0 || mRetriggerDelay.count() > 0; }
+    bool admitSource(SourceImpl *source);
+
+    void setInstanceLimit(ALuint limit, InstanceSteal steal);
+    ALuint getInstanceLimit() const { return mInstanceLimit; }
+    InstanceSteal getInstanceSteal() const { return mInstanceSteal; }
+
+    void setRetriggerDelay(std::chrono::milliseconds delay);
+    std::chrono::milliseconds getRetriggerDelay() const { return mRetriggerDelay; }
+
     StringView getName() const { return mName; }
 
     size_t getSourceCount() const { return mSources.size(); }
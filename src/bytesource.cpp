@@ -0,0 +1,159 @@
+
+#include "config.h"
+
+#include "bytesource.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <limits>
+
+#include "mappedfile.h"
+
+namespace {
+
+using alure::ByteSource;
+using alure::ArrayView;
+
+class MemoryByteSource final : public ByteSource {
+    ArrayView<ALbyte> mData;
+    uint64_t mPos;
+
+public:
+    MemoryByteSource(ArrayView<ALbyte> data, uint64_t pos) : mData(data), mPos(pos) { }
+
+    size_t read(void *ptr, size_t count) noexcept override
+    {
+        if(mPos >= mData.size()) return 0;
+        count = static_cast<size_t>(std::min<uint64_t>(count, mData.size()-mPos));
+        memcpy(ptr, mData.data()+mPos, count);
+        mPos += count;
+        return count;
+    }
+    bool seek(uint64_t pos) noexcept override { mPos = pos; return true; }
+    bool skip(uint64_t count) noexcept override
+    {
+        if(count > mData.size() - std::min<uint64_t>(mPos, mData.size()))
+        {
+            mPos = std::max<uint64_t>(mPos, mData.size());
+            return false;
+        }
+        mPos += count;
+        return true;
+    }
+    uint64_t tell() noexcept override { return mPos; }
+    uint64_t size() noexcept override { return mData.size(); }
+    ArrayView<ALbyte> getView() noexcept override { return mData; }
+};
+
+class StreamByteSource final : public ByteSource {
+    std::istream &mStream;
+    uint64_t mSize{UnknownSize};
+    bool mHaveSize{false};
+
+public:
+    StreamByteSource(std::istream &stream) : mStream(stream) { }
+
+    size_t read(void *ptr, size_t count) noexcept override
+    {
+        mStream.clear();
+        mStream.read(static_cast<char*>(ptr), count);
+        return static_cast<size_t>(mStream.gcount());
+    }
+    bool seek(uint64_t pos) noexcept override
+    {
+        mStream.clear();
+        return static_cast<bool>(mStream.seekg(static_cast<std::streamoff>(pos)));
+    }
+    bool skip(uint64_t count) noexcept override
+    {
+        mStream.clear();
+        while(count > 0)
+        {
+            auto todo = static_cast<std::streamsize>(
+                std::min<uint64_t>(count, std::numeric_limits<std::streamsize>::max())
+            );
+            if(mStream.ignore(todo).gcount() != todo) return false;
+            count -= static_cast<uint64_t>(todo);
+        }
+        return true;
+    }
+    uint64_t tell() noexcept override
+    {
+        mStream.clear();
+        std::streamoff pos = mStream.tellg();
+        return (pos < 0) ? InvalidPos : static_cast<uint64_t>(pos);
+    }
+    uint64_t size() noexcept override
+    {
+        if(!mHaveSize)
+        {
+            mStream.clear();
+            std::streampos pos = mStream.tellg();
+            if(pos != static_cast<std::streampos>(-1) && mStream.seekg(0, std::ios::end))
+            {
+                mSize = static_cast<uint64_t>(std::streamoff(mStream.tellg()));
+                mStream.seekg(pos);
+            }
+            mHaveSize = true;
+        }
+        return mSize;
+    }
+};
+
+} // namespace
+
+namespace alure {
+
+constexpr uint64_t ByteSource::UnknownSize;
+constexpr uint64_t ByteSource::InvalidPos;
+
+bool ByteSource::seek(int64_t offset, int whence) noexcept
+{
+    uint64_t base;
+    if(whence == SEEK_SET)
+        base = 0;
+    else if(whence == SEEK_CUR)
+    {
+        base = tell();
+        if(base == InvalidPos) return false;
+    }
+    else if(whence == SEEK_END)
+    {
+        base = size();
+        if(base == UnknownSize) return false;
+    }
+    else
+        return false;
+
+    if(offset < 0 && static_cast<uint64_t>(-offset) > base)
+        return false;
+    return seek(base + offset);
+}
+
+UniquePtr<ByteSource> MakeByteSource(std::istream &stream)
+{
+    ArrayView<ALbyte> mapping = GetStreamMapping(stream);
+    if(!mapping.empty())
+    {
+        stream.clear();
+        std::streamoff pos = stream.tellg();
+        return MakeUnique<MemoryByteSource>(mapping, (pos < 0) ? 0 : pos);
+    }
+    return MakeUnique<StreamByteSource>(stream);
+}
+
+UniquePtr<ByteSource> MakeByteSource(ArrayView<ALbyte> data)
+{ return MakeUnique<MemoryByteSource>(data, 0); }
+
+SignatureMatch CheckOggSignature(ArrayView<ALbyte> header, const char *id, size_t idlen)
+{
+    if(header.size() < 27 || memcmp(header.data(), "OggS", 4) != 0)
+        return SignatureMatch::NoMatch;
+    size_t start = 27 + static_cast<ALubyte>(header[26]);
+    if(header.size() >= start+idlen && memcmp(header.data()+start, id, idlen) == 0)
+        return SignatureMatch::Match;
+    return SignatureMatch::Unknown;
+}
+
+} // namespace alure
@@ -0,0 +1,58 @@
+#ifndef BYTESOURCE_H
+#define BYTESOURCE_H
+
+#include "main.h"
+
+#include <istream>
+#include <cstdio>
+
+namespace alure {
+
+// Minimal random-access input for the decoders. Unlike std::istream, reads
+// don't construct sentries or update stream state on every call, and a
+// source in memory can be read in place. Like a file, seeking past the end
+// is allowed, with reads there returning nothing.
+class ByteSource {
+public:
+    static constexpr uint64_t UnknownSize = ~uint64_t{0};
+    static constexpr uint64_t InvalidPos = ~uint64_t{0};
+
+    virtual ~ByteSource() = default;
+
+    // Reads up to count bytes, returning how many were read. Returning less
+    // than count indicates the end of the source, or an error.
+    virtual size_t read(void *ptr, size_t count) noexcept = 0;
+    // Sets the absolute read offset, returning false if it can't be set.
+    virtual bool seek(uint64_t pos) noexcept = 0;
+    // Moves the read offset forward by count bytes. Unlike seek, this works
+    // on sources that can't seek. Returns false if the end came first.
+    virtual bool skip(uint64_t count) noexcept = 0;
+    // Returns the current read offset, or InvalidPos if it isn't known.
+    virtual uint64_t tell() noexcept = 0;
+    // Returns the total size in bytes, or UnknownSize.
+    virtual uint64_t size() noexcept = 0;
+    // Returns the whole source if it's in memory, or an empty view.
+    virtual ArrayView<ALbyte> getView() noexcept { return {}; }
+
+    // Seeks relative to the start, current offset, or end (SEEK_SET,
+    // SEEK_CUR, SEEK_END), as used by the codec libraries' callbacks.
+    bool seek(int64_t offset, int whence) noexcept;
+};
+
+// Makes a ByteSource reading from the stream, starting at its current
+// offset. If the stream is a memory-mapped file, the source reads straight
+// from the mapping instead of through the stream. The stream must outlive
+// the source.
+UniquePtr<ByteSource> MakeByteSource(std::istream &stream);
+// Makes a ByteSource reading from the given memory, starting at its
+// beginning. The memory must outlive the source.
+UniquePtr<ByteSource> MakeByteSource(ArrayView<ALbyte> data);
+
+// Checks a file header for an Ogg page whose first packet starts with the
+// given codec ID, for the Ogg-based decoders' checkSignature. Other Ogg files
+// may still hold the codec in a later stream.
+SignatureMatch CheckOggSignature(ArrayView<ALbyte> header, const char *id, size_t idlen);
+
+} // namespace alure
+
+#endif /* BYTESOURCE_H */
@@ -41,6 +41,8 @@
 #include "auxeffectslot.h"
 #include "effect.h"
 #include "sourcegroup.h"
+#include "mappedfile.h"
+#include "fileprefetch.h"
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -249,12 +251,40 @@ const DecoderEntryPair sDefaultDecoders[] = {
 alure::Vector<DecoderEntryPair> sDecoders;
 
 
+// How much of the start of a file is given to the decoder factories' signature
+// checks.
+constexpr size_t DecoderSignatureSize = 64;
+
 alure::DecoderOrExceptT GetDecoder(alure::UniquePtr<std::istream> &file,
-                                   alure::ArrayView<DecoderEntryPair> decoders)
-{
-    while(!decoders.empty())
+                                   alure::ArrayView<DecoderEntryPair> decoders,
+                                   alure::ArrayView<ALbyte> header)
+{
+    // Try the factories that recognize the header first, then the ones that
+    // can't tell, skipping any that rule it out. Without a header, they're
+    // all tried in order.
+    alure::Vector<alure::DecoderFactory*> factories;
+    factories.reserve(decoders.size());
+    if(header.empty())
+    {
+        for(const DecoderEntryPair &entry : decoders)
+            factories.push_back(entry.second.get());
+    }
+    else
+    {
+        alure::Vector<alure::DecoderFactory*> unknown;
+        for(const DecoderEntryPair &entry : decoders)
+        {
+            alure::SignatureMatch match = entry.second->checkSignature(header);
+            if(match == alure::SignatureMatch::Match)
+                factories.push_back(entry.second.get());
+            else if(match == alure::SignatureMatch::Unknown)
+                unknown.push_back(entry.second.get());
+        }
+        factories.insert(factories.end(), unknown.begin(), unknown.end());
+    }
+
+    for(alure::DecoderFactory *factory : factories)
     {
-        alure::DecoderFactory *factory = decoders.front().second.get();
         auto decoder = factory->createDecoder(file);
         if(decoder) return std::move(decoder);
 
@@ -262,8 +292,6 @@ alure::DecoderOrExceptT GetDecoder(alure::UniquePtr<std::istream> &file,
             return std::make_exception_ptr(
                 std::runtime_error("Failed to rewind file for the next decoder factory")
             );
-
-        decoders = decoders.slice(1);
     }
 
     return alure::SharedPtr<alure::Decoder>(nullptr);
@@ -271,16 +299,34 @@ alure::DecoderOrExceptT GetDecoder(alure::UniquePtr<std::istream> &file,
 
 static alure::DecoderOrExceptT GetDecoder(alure::UniquePtr<std::istream> file)
 {
-    auto decoder = GetDecoder(file, sDecoders);
+    // Read the start of the file for the factories to check their signatures
+    // against. This needs a seekable file to rewind, otherwise the factories
+    // are tried without it.
+    alure::Array<ALbyte,DecoderSignatureSize> header;
+    size_t header_len = 0;
+    if(file->tellg() == 0)
+    {
+        file->read(reinterpret_cast<char*>(header.data()), header.size());
+        header_len = static_cast<size_t>(file->gcount());
+        if(!(file->clear(),file->seekg(0)))
+            return std::make_exception_ptr(
+                std::runtime_error("Failed to rewind file after reading its header")
+            );
+    }
+    alure::ArrayView<ALbyte> headerview(header.data(), header_len);
+
+    auto decoder = GetDecoder(file, sDecoders, headerview);
     if(std::holds_alternative<std::exception_ptr>(decoder)) return decoder;
     if(std::get<alure::SharedPtr<alure::Decoder>>(decoder)) return decoder;
-    decoder = GetDecoder(file, sDefaultDecoders);
+    decoder = GetDecoder(file, sDefaultDecoders, headerview);
     if(std::holds_alternative<std::exception_ptr>(decoder)) return decoder;
     if(std::get<alure::SharedPtr<alure::Decoder>>(decoder)) return decoder;
     return (decoder = std::make_exception_ptr(std::runtime_error("No decoder found")));
 }
 
 class DefaultFileIOFactory final : public alure::FileIOFactory {
+    alure::FilePrefetcher mPrefetcher;
+
     alure::UniquePtr<std::istream> openFile(const alure::String &name) noexcept override
     {
 #ifdef _WIN32
@@ -291,6 +337,16 @@ class DefaultFileIOFactory final : public alure::FileIOFactory {
         if(!file->is_open()) file = nullptr;
         return std::move(file);
     }
+
+    void prefetchFiles(alure::ArrayView<alure::StringView> names) noexcept override
+    {
+        // Prefetching is only a hint, so failing to start it is harmless.
+        try {
+            mPrefetcher.add(names);
+        }
+        catch(...) {
+        }
+    }
 };
 DefaultFileIOFactory sDefaultFileFactory;
 
@@ -311,6 +367,58 @@ static inline void CheckContext(const ContextImpl *ctx)
     }
 }
 
+// Helpers to manage the source update lists. Sources are appended to the end of
+// a list, and removed by moving the last entry into its place, with each
+// source's position tracked so it can be found without a search.
+static inline SourceImpl *GetListSource(SourceImpl *source) { return source; }
+template<typename T>
+static inline SourceImpl *GetListSource(const T &entry) { return entry.mSource; }
+
+template<typename T>
+static inline void AddListEntry(Vector<T> &list, SourceList which, T entry)
+{
+    GetListSource(entry)->setListIndex(which, list.size());
+    list.push_back(std::move(entry));
+}
+
+template<typename T>
+static inline void EraseListEntry(Vector<T> &list, SourceList which, size_t idx)
+{
+    GetListSource(list[idx])->setListIndex(which, InvalidListIdx);
+    if(idx < list.size()-1)
+    {
+        list[idx] = std::move(list.back());
+        GetListSource(list[idx])->setListIndex(which, idx);
+    }
+    list.pop_back();
+}
+
+// Calls the update function for each entry in the list, removing the entries
+// it returns false for. An update may also remove its own entry directly (e.g.
+// by stopping the source), in which case the entry moved into its slot is
+// checked next.
+template<typename T, typename F>
+static inline void UpdateList(Vector<T> &list, SourceList which, F&& func)
+{
+    size_t idx = 0;
+    while(idx < list.size())
+    {
+        SourceImpl *source = GetListSource(list[idx]);
+        if(func(list[idx]))
+        {
+            if(source->getListIndex(which) == idx)
+                ++idx;
+        }
+        else
+        {
+            // The update may have already removed or moved the entry.
+            size_t cur = source->getListIndex(which);
+            if(cur != InvalidListIdx)
+                EraseListEntry(list, which, cur);
+        }
+    }
+}
+
 std::variant<std::monostate,uint64_t> ParseTimeval(StringView strval, double srate) noexcept
 {
     try {
@@ -380,8 +488,13 @@ std::variant<std::monostate,uint64_t> ParseTimeval(StringView strval, double sra
 
 
 Decoder::~Decoder() { }
+ArrayView<ALbyte> Decoder::getDirectData() noexcept { return {}; }
+SharedPtr<Decoder> Decoder::cloneAt(uint64_t) const noexcept { return nullptr; }
 DecoderFactory::~DecoderFactory() { }
 
+SignatureMatch DecoderFactory::checkSignature(ArrayView<ALbyte>) const noexcept
+{ return SignatureMatch::Unknown; }
+
 void RegisterDecoder(StringView name, UniquePtr<DecoderFactory> factory)
 {
     auto iter = std::lower_bound(sDecoders.begin(), sDecoders.end(), name,
@@ -412,6 +525,8 @@ UniquePtr<DecoderFactory> UnregisterDecoder(StringView name) noexcept
 
 FileIOFactory::~FileIOFactory() { }
 
+void FileIOFactory::prefetchFiles(ArrayView<StringView>) noexcept { }
+
 UniquePtr<FileIOFactory> FileIOFactory::set(UniquePtr<FileIOFactory> factory) noexcept
 {
     sFileFactory.swap(factory);
@@ -443,6 +558,10 @@ void MessageHandler::sourceForceStopped(Source) noexcept
 {
 }
 
+void MessageHandler::streamUnderrun(Source, std::chrono::nanoseconds) noexcept
+{
+}
+
 void MessageHandler::bufferLoading(StringView, ChannelConfig, SampleType, ALuint, ArrayView<ALbyte>) noexcept
 {
 }
@@ -509,6 +628,16 @@ static void LoadSourceLatency(ContextImpl *ctx)
     LoadALFunc(&ctx->alGetSourcedvSOFT, "alGetSourcedvSOFT");
 }
 
+static void LoadSourceStartDelay(ContextImpl *ctx)
+{
+    LoadALFunc(&ctx->alSourcePlayAtTimeSOFT, "alSourcePlayAtTimeSOFT");
+}
+
+static void LoadCallbackBuffer(ContextImpl *ctx)
+{
+    LoadALFunc(&ctx->alBufferCallbackSOFT, "alBufferCallbackSOFT");
+}
+
 static const struct {
     AL extension;
     const char name[32];
@@ -528,6 +657,8 @@ static const struct {
     { AL::SOFT_source_latency,    "AL_SOFT_source_latency",    LoadSourceLatency },
     { AL::SOFT_source_resampler,  "AL_SOFT_source_resampler",  LoadSourceResampler },
     { AL::SOFT_source_spatialize, "AL_SOFT_source_spatialize", LoadNothing },
+    { AL::SOFT_source_start_delay, "AL_SOFT_source_start_delay", LoadSourceStartDelay },
+    { AL::SOFT_callback_buffer,   "AL_SOFT_callback_buffer",   LoadCallbackBuffer },
 
     { AL::EXT_disconnect, "ALC_EXT_disconnect", LoadNothing },
 
@@ -609,14 +740,14 @@ void ContextImpl::backgroundProc()
     std::unique_lock<std::mutex> ctxlock(gGlobalCtxMutex);
     while(!mQuitThread.load(std::memory_order_acquire))
     {
+        std::chrono::steady_clock::time_point next_start;
         {
             std::lock_guard<std::mutex> srclock(mSourceStreamMutex);
-            mStreamingSources.erase(
-                std::remove_if(mStreamingSources.begin(), mStreamingSources.end(),
-                    [](SourceImpl *source) -> bool
-                    { return !source->updateAsync(); }
-                ), mStreamingSources.end()
+            UpdateList(mStreamingSources, SourceList::Async,
+                [](SourceImpl *source) -> bool
+                { return source->updateAsync(); }
             );
+            next_start = startScheduledSources();
         }
 
         // Only do one pending buffer at a time. In case there's several large
@@ -633,13 +764,20 @@ void ContextImpl::backgroundProc()
         }
 
         std::unique_lock<std::mutex> wakelock(mWakeMutex);
-        if(!mQuitThread.load(std::memory_order_acquire) && lastpb->mNext.load(std::memory_order_acquire) == nullptr)
+        if(!mQuitThread.load(std::memory_order_acquire) && lastpb->mNext.load(std::memory_order_acquire) == nullptr &&
+           !mWakePending.exchange(false, std::memory_order_acq_rel))
         {
             ctxlock.unlock();
 
+            const bool scheduled = (next_start != std::chrono::steady_clock::time_point::max());
             std::chrono::milliseconds interval = mWakeInterval.load(std::memory_order_relaxed);
             if(interval.count() == 0)
-                mWakeThread.wait(wakelock);
+            {
+                if(!scheduled)
+                    mWakeThread.wait(wakelock);
+                else
+                    mWakeThread.wait_until(wakelock, next_start);
+            }
             else
             {
                 auto now = std::chrono::steady_clock::now() - basetime;
@@ -648,7 +786,7 @@ void ContextImpl::backgroundProc()
                     auto mult = (now-waketime + interval-std::chrono::milliseconds(1)) / interval;
                     waketime += interval * mult;
                 }
-                mWakeThread.wait_until(wakelock, waketime + basetime);
+                mWakeThread.wait_until(wakelock, std::min(waketime + basetime, next_start));
             }
             wakelock.unlock();
 
@@ -757,6 +895,7 @@ void ContextImpl::destroy()
         if(!mSourceIds.empty())
             alDeleteSources(static_cast<ALsizei>(mSourceIds.size()), mSourceIds.data());
         mSourceIds.clear();
+        mStreamPool->deleteBufferIds();
 
         for(auto &bufptr : mBuffers)
         {
@@ -820,11 +959,34 @@ void ContextImpl::setAsyncWakeInterval(std::chrono::milliseconds interval)
     mWakeThread.notify_all();
 }
 
+DECL_THUNK1(void, Context, setStreamDecodeAhead,, std::chrono::milliseconds)
+void ContextImpl::setStreamDecodeAhead(std::chrono::milliseconds ahead)
+{
+    if(ahead.count() < 0 || ahead > std::chrono::seconds(10))
+        throw std::out_of_range("Decode-ahead time out of range");
+    mDecodeAhead.store(ahead);
+}
+
 
-DecoderOrExceptT ContextImpl::findDecoder(StringView name)
+// Opens a file through the FileIOFactory. Files for buffers are read whole,
+// right away, so the default factory maps them into memory when possible, for
+// decoders to use in place. Streamed files aren't mapped, since a file that's
+// truncated while mapped crashes the reader instead of giving a read error.
+static UniquePtr<std::istream> OpenFile(const String &name, bool forbuffer)
+{
+    FileIOFactory &factory = FileIOFactory::get();
+    if(forbuffer && &factory == &sDefaultFileFactory)
+    {
+        if(auto mapped = OpenMappedFile(name.c_str()))
+            return mapped;
+    }
+    return factory.openFile(name);
+}
+
+DecoderOrExceptT ContextImpl::findDecoder(StringView name, bool forbuffer)
 {
     String oldname = String(name);
-    auto file = FileIOFactory::get().openFile(oldname);
+    auto file = OpenFile(oldname, forbuffer);
     if(UNLIKELY(!file))
     {
         // Resource not found. Try to find a substitute.
@@ -834,7 +996,7 @@ DecoderOrExceptT ContextImpl::findDecoder(StringView name)
             String newname(mMessage->resourceNotFound(oldname));
             if(newname.empty())
                 return std::make_exception_ptr(std::runtime_error("Failed to open file"));
-            file = FileIOFactory::get().openFile(newname);
+            file = OpenFile(newname, forbuffer);
             oldname = std::move(newname);
         } while(!file);
     }
@@ -851,6 +1013,87 @@ SharedPtr<Decoder> ContextImpl::createDecoder(StringView name)
     std::rethrow_exception(std::get<std::exception_ptr>(dec));
 }
 
+SharedPtr<Decoder> ContextImpl::createBufferDecoder(StringView name)
+{
+    DecoderOrExceptT dec = findDecoder(name, true);
+    if(SharedPtr<Decoder> *decoder = std::get_if<SharedPtr<Decoder>>(&dec))
+        return std::move(*decoder);
+    std::rethrow_exception(std::get<std::exception_ptr>(dec));
+}
+
+DECL_THUNK1(SharedPtr<Decoder>, Context, createSharedDecoder,, SharedPtr<Decoder>)
+SharedPtr<Decoder> ContextImpl::createSharedDecoder(SharedPtr<Decoder>&& decoder)
+{
+    CheckContext(this);
+    if(!decoder) throw std::invalid_argument("Invalid decoder");
+
+    auto iter = mSharedStreams.begin();
+    while(iter != mSharedStreams.end())
+    {
+        if(iter->second.expired())
+            iter = mSharedStreams.erase(iter);
+        else
+            ++iter;
+    }
+
+    SharedPtr<SharedDecodeStream> stream;
+    iter = mSharedStreams.find(decoder.get());
+    if(iter != mSharedStreams.end())
+        stream = iter->second.lock();
+    else
+    {
+        ALuint srate = decoder->getFrequency();
+        ALuint frame_size = FramesToBytes(1, decoder->getChannelConfig(),
+                                          decoder->getSampleType());
+        // Hold a few seconds, so taps can drift apart by as much as their
+        // queued and decoded-ahead audio before one gets skipped forward.
+        ALuint window = std::max(srate, 1u) * 4;
+        Decoder *key = decoder.get();
+        stream = MakeShared<SharedDecodeStream>(std::move(decoder), frame_size, window);
+        mSharedStreams.emplace(key, stream);
+    }
+    return MakeShared<SharedDecoderTap>(std::move(stream));
+}
+
+DECL_THUNK3(SharedPtr<Decoder>, Context, prepareStream,, StringView, ALsizei, ALsizei)
+SharedPtr<Decoder> ContextImpl::prepareStream(StringView name, ALsizei chunk_len,
+                                              ALsizei queue_size)
+{ return prepareStream(createDecoder(name), chunk_len, queue_size); }
+
+DECL_THUNK3(SharedPtr<Decoder>, Context, prepareStream,, SharedPtr<Decoder>, ALsizei, ALsizei)
+SharedPtr<Decoder> ContextImpl::prepareStream(SharedPtr<Decoder>&& decoder, ALsizei chunk_len,
+                                              ALsizei queue_size)
+{
+    if(!decoder) throw std::invalid_argument("Invalid decoder");
+    if(chunk_len < 64)
+        throw std::out_of_range("Update length out of range");
+    if(queue_size < 2)
+        throw std::out_of_range("Queue size out of range");
+    CheckContext(this);
+
+    ChannelConfig chans = decoder->getChannelConfig();
+    SampleType type = decoder->getSampleType();
+    if(GetFormat(chans, type) == AL_NONE)
+    {
+        auto str = String("Unsupported format (")+GetSampleTypeName(type)+", "+
+                   GetChannelConfigName(chans)+")";
+        throw std::runtime_error(str);
+    }
+    ALuint frame_size = FramesToBytes(1, chans, type);
+
+    auto looppts = decoder->getLoopPoints();
+    if(looppts.first >= looppts.second)
+    {
+        looppts.first = 0;
+        looppts.second = std::numeric_limits<uint64_t>::max();
+    }
+
+    auto ahead = MakeShared<DecodeAhead>(decoder, frame_size, chunk_len, queue_size, looppts,
+                                         mStreamPool);
+    mDecodeWorker.add(ahead);
+    return MakeShared<PreparedDecoder>(std::move(decoder), std::move(ahead), frame_size);
+}
+
 
 DECL_THUNK2(bool, Context, isSupported, const, ChannelConfig, SampleType)
 bool ContextImpl::isSupported(ChannelConfig channels, SampleType type) const
@@ -919,11 +1162,24 @@ BufferOrExceptT ContextImpl::doCreateBuffer(StringView name, size_t name_hash, B
         std::min<uint64_t>(decoder->getLength(), std::numeric_limits<ALuint>::max())
     );
 
-    Vector<ALbyte> data(FramesToBytes(frames, chans, type));
-    frames = decoder->read(data.data(), frames);
+    // Use the decoder's samples in place if it has them in memory, rather
+    // than reading a copy.
+    Vector<ALbyte> data;
+    ArrayView<ALbyte> samples = decoder->getDirectData();
+    if(!samples.empty())
+    {
+        size_t direct_frames = samples.size() / FramesToBytes(1, chans, type);
+        frames = static_cast<ALuint>(std::min<size_t>(frames, direct_frames));
+    }
+    else
+    {
+        data.resize(FramesToBytes(frames, chans, type));
+        frames = ReadBufferFrames(*decoder, data.data(), frames, chans, type);
+        samples = data;
+    }
     if(!frames)
         return std::make_exception_ptr(std::runtime_error("No samples for buffer"));
-    data.resize(FramesToBytes(frames, chans, type));
+    samples = samples.slice(0, FramesToBytes(frames, chans, type));
 
     std::pair<uint64_t,uint64_t> loop_pts = decoder->getLoopPoints();
     if(loop_pts.first >= loop_pts.second)
@@ -945,12 +1201,12 @@ BufferOrExceptT ContextImpl::doCreateBuffer(StringView name, size_t name_hash, B
     }
 
     if(mMessage.get())
-        mMessage->bufferLoading(name, chans, type, srate, data);
+        mMessage->bufferLoading(name, chans, type, srate, samples);
 
     alGetError();
     ALuint bid = 0;
     alGenBuffers(1, &bid);
-    alBufferData(bid, format, data.data(), static_cast<ALsizei>(data.size()), srate);
+    alBufferData(bid, format, samples.data(), static_cast<ALsizei>(samples.size()), srate);
     if(hasExtension(AL::SOFT_loop_points))
     {
         ALint pts[2]{(ALint)loop_pts.first, (ALint)loop_pts.second};
@@ -1053,7 +1309,7 @@ Buffer ContextImpl::getBuffer(StringView name)
     if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
         return Buffer(iter->get());
 
-    BufferOrExceptT ret = doCreateBuffer(name, name_hash, iter, createDecoder(name));
+    BufferOrExceptT ret = doCreateBuffer(name, name_hash, iter, createBufferDecoder(name));
     Buffer *buffer = std::get_if<Buffer>(&ret);
     if(UNLIKELY(!buffer))
         std::rethrow_exception(std::get<std::exception_ptr>(ret));
@@ -1104,7 +1360,7 @@ SharedFuture<Buffer> ContextImpl::getBufferAsync(StringView name)
     Promise<Buffer> promise;
     future = promise.get_future().share();
 
-    BufferOrExceptT ret = doCreateBufferAsync(name, name_hash, iter, createDecoder(name), std::move(promise));
+    BufferOrExceptT ret = doCreateBufferAsync(name, name_hash, iter, createBufferDecoder(name), std::move(promise));
     Buffer *buffer = std::get_if<Buffer>(&ret);
     if(UNLIKELY(!buffer))
         std::rethrow_exception(std::get<std::exception_ptr>(ret));
@@ -1137,17 +1393,41 @@ void ContextImpl::precacheBuffersAsync(ArrayView<StringView> names)
         );
     }
 
+    // Start reading the files that aren't loaded yet all at once, so they
+    // don't each wait for the one before.
     auto hasher = std::hash<StringView>();
+    Vector<std::pair<StringView,size_t>> toload;
+    toload.reserve(names.size());
     for(const StringView name : names)
     {
         size_t name_hash = hasher(name);
 
         // Check if the buffer that's being created already exists
         auto iter = findBufferName(name, name_hash);
+        if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
+            continue;
+        toload.emplace_back(name, name_hash);
+    }
+    if(toload.size() > 1)
+    {
+        Vector<StringView> prefetch;
+        prefetch.reserve(toload.size());
+        for(const auto &entry : toload)
+            prefetch.push_back(entry.first);
+        FileIOFactory::get().prefetchFiles(prefetch);
+    }
+
+    for(const auto &entry : toload)
+    {
+        const StringView name = entry.first;
+        const size_t name_hash = entry.second;
+
+        // Names may repeat, so check again in case it was just created.
+        auto iter = findBufferName(name, name_hash);
         if(iter != mBuffers.end() && (*iter)->getNameHash() == name_hash)
             continue;
 
-        DecoderOrExceptT dec = findDecoder(name);
+        DecoderOrExceptT dec = findDecoder(name, true);
         SharedPtr<Decoder> *decoder = std::get_if<SharedPtr<Decoder>>(&dec);
         if(!decoder) continue;
 
@@ -1344,14 +1624,12 @@ void ContextImpl::removeBuffer(StringView name)
     {
         // Remove pending sources whose future was waiting for this buffer.
         BufferImpl *buffer = iter->get();
-        mPendingSources.erase(
-            std::remove_if(mPendingSources.begin(), mPendingSources.end(),
-                [buffer](PendingSource &entry) -> bool
-                {
-                    return (GetFutureState(entry.mFuture) == std::future_status::ready &&
-                            entry.mFuture.get().getHandle() == buffer);
-                }
-            ), mPendingSources.end()
+        UpdateList(mPendingSources, SourceList::Pending,
+            [buffer](PendingSource &entry) -> bool
+            {
+                return !(GetFutureState(entry.mFuture) == std::future_status::ready &&
+                         entry.mFuture.get().getHandle() == buffer);
+            }
         );
         (*iter)->cleanup();
         mBuffers.erase(iter);
@@ -1418,95 +1696,62 @@ Source ContextImpl::createSource()
 
 void ContextImpl::addPendingSource(SourceImpl *source, SharedFuture<Buffer> future)
 {
-    auto iter = std::lower_bound(mPendingSources.begin(), mPendingSources.end(), source,
-        [](const PendingSource &lhs, SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    if(iter != mPendingSources.end() && iter->mSource == source)
-        iter->mFuture = std::move(future);
+    size_t idx = source->getListIndex(SourceList::Pending);
+    if(idx != InvalidListIdx)
+        mPendingSources[idx].mFuture = std::move(future);
     else
-        mPendingSources.insert(iter, {source, std::move(future)});
+        AddListEntry(mPendingSources, SourceList::Pending, PendingSource{source, std::move(future)});
 }
 
 void ContextImpl::removePendingSource(SourceImpl *source)
 {
-    auto iter = std::lower_bound(mPendingSources.begin(), mPendingSources.end(), source,
-        [](const PendingSource &lhs, SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    if(iter != mPendingSources.end() && iter->mSource == source)
-        mPendingSources.erase(iter);
+    size_t idx = source->getListIndex(SourceList::Pending);
+    if(idx != InvalidListIdx)
+        EraseListEntry(mPendingSources, SourceList::Pending, idx);
 }
 
 bool ContextImpl::isPendingSource(const SourceImpl *source) const
 {
-    auto iter = std::lower_bound(mPendingSources.begin(), mPendingSources.end(), source,
-        [](const PendingSource &lhs, const SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    return (iter != mPendingSources.end() && iter->mSource == source);
+    return source->getListIndex(SourceList::Pending) != InvalidListIdx;
 }
 
-void ContextImpl::addFadingSource(SourceImpl *source, std::chrono::nanoseconds duration, ALfloat gain)
+void ContextImpl::addFadingSource(const SourceFadeUpdateEntry &fade)
 {
-    auto iter = std::lower_bound(mFadingSources.begin(), mFadingSources.end(), source,
-        [](const SourceFadeUpdateEntry &lhs, SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    if(iter == mFadingSources.end() || iter->mSource != source)
-    {
-        auto now = mDevice.getClockTime();
-        mFadingSources.emplace(iter, SourceFadeUpdateEntry{source, now, now+duration, true, gain});
-    }
+    size_t idx = fade.mSource->getListIndex(SourceList::Fading);
+    if(idx == InvalidListIdx)
+        AddListEntry(mFadingSources, SourceList::Fading, fade);
+    else
+        mFadingSources[idx] = fade;
 }
 
 void ContextImpl::removeFadingSource(SourceImpl *source)
 {
-    auto iter = std::lower_bound(mFadingSources.begin(), mFadingSources.end(), source,
-        [](const SourceFadeUpdateEntry &lhs, SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    if(iter != mFadingSources.end() && iter->mSource == source)
-        mFadingSources.erase(iter);
+    size_t idx = source->getListIndex(SourceList::Fading);
+    if(idx != InvalidListIdx)
+        EraseListEntry(mFadingSources, SourceList::Fading, idx);
 }
 
 void ContextImpl::addPlayingSource(SourceImpl *source, ALuint id)
 {
-    auto iter = std::lower_bound(mPlaySources.begin(), mPlaySources.end(), source,
-        [](const SourceBufferUpdateEntry &lhs, SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    if(iter == mPlaySources.end() || iter->mSource != source)
-        mPlaySources.insert(iter, {source,id});
+    if(source->getListIndex(SourceList::Playing) == InvalidListIdx)
+        AddListEntry(mPlaySources, SourceList::Playing, SourceBufferUpdateEntry{source,id});
 }
 
 void ContextImpl::addPlayingSource(SourceImpl *source)
 {
-    auto iter = std::lower_bound(mStreamSources.begin(), mStreamSources.end(), source,
-        [](const SourceStreamUpdateEntry &lhs, SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    if(iter == mStreamSources.end() || iter->mSource != source)
-        mStreamSources.insert(iter, {source});
+    if(source->getListIndex(SourceList::Streaming) == InvalidListIdx)
+        AddListEntry(mStreamSources, SourceList::Streaming, SourceStreamUpdateEntry{source});
 }
 
 void ContextImpl::removePlayingSource(SourceImpl *source)
 {
-    auto iter0 = std::lower_bound(mPlaySources.begin(), mPlaySources.end(), source,
-        [](const SourceBufferUpdateEntry &lhs, SourceImpl *rhs) -> bool
-        { return lhs.mSource < rhs; }
-    );
-    if(iter0 != mPlaySources.end() && iter0->mSource == source)
-        mPlaySources.erase(iter0);
-    else
-    {
-        auto iter1 = std::lower_bound(mStreamSources.begin(), mStreamSources.end(), source,
-            [](const SourceStreamUpdateEntry &lhs, SourceImpl *rhs) -> bool
-            { return lhs.mSource < rhs; }
-        );
-        if(iter1 != mStreamSources.end() && iter1->mSource == source)
-            mStreamSources.erase(iter1);
-    }
+    size_t idx = source->getListIndex(SourceList::Playing);
+    if(idx != InvalidListIdx)
+        EraseListEntry(mPlaySources, SourceList::Playing, idx);
+    else if((idx=source->getListIndex(SourceList::Streaming)) != InvalidListIdx)
+        EraseListEntry(mStreamSources, SourceList::Streaming, idx);
+    else if((idx=source->getListIndex(SourceList::Virtual)) != InvalidListIdx)
+        EraseListEntry(mVirtualSources, SourceList::Virtual, idx);
 }
 
 
@@ -1515,24 +1760,88 @@ void ContextImpl::addStream(SourceImpl *source)
     std::lock_guard<std::mutex> lock(mSourceStreamMutex);
     if(mThread.get_id() == std::thread::id())
         mThread = std::thread(std::mem_fn(&ContextImpl::backgroundProc), this);
-    auto iter = std::lower_bound(mStreamingSources.begin(), mStreamingSources.end(), source);
-    if(iter == mStreamingSources.end() || *iter != source)
-        mStreamingSources.insert(iter, source);
+    if(source->getListIndex(SourceList::Async) == InvalidListIdx)
+        AddListEntry(mStreamingSources, SourceList::Async, source);
 }
 
 void ContextImpl::removeStream(SourceImpl *source)
 {
     std::lock_guard<std::mutex> lock(mSourceStreamMutex);
-    auto iter = std::lower_bound(mStreamingSources.begin(), mStreamingSources.end(), source);
-    if(iter != mStreamingSources.end() && *iter == source)
-        mStreamingSources.erase(iter);
+    removeStreamNoLock(source);
 }
 
 void ContextImpl::removeStreamNoLock(SourceImpl *source)
 {
-    auto iter = std::lower_bound(mStreamingSources.begin(), mStreamingSources.end(), source);
-    if(iter != mStreamingSources.end() && *iter == source)
-        mStreamingSources.erase(iter);
+    size_t idx = source->getListIndex(SourceList::Async);
+    if(idx != InvalidListIdx)
+        EraseListEntry(mStreamingSources, SourceList::Async, idx);
+}
+
+
+void ContextImpl::addScheduledSource(SourceImpl *source, std::chrono::steady_clock::time_point start_time)
+{
+    {
+        std::lock_guard<std::mutex> lock(mSourceStreamMutex);
+        if(mThread.get_id() == std::thread::id())
+            mThread = std::thread(std::mem_fn(&ContextImpl::backgroundProc), this);
+        removeScheduledSourceNoLock(source);
+        auto iter = std::upper_bound(mScheduledSources.begin(), mScheduledSources.end(), start_time,
+            [](std::chrono::steady_clock::time_point lhs, const ScheduledSource &rhs) -> bool
+            { return lhs < rhs.mStartTime; }
+        );
+        mScheduledSources.insert(iter, ScheduledSource{source, start_time});
+    }
+
+    // The thread needs to recalculate when to wake up.
+    wakeBackground();
+}
+
+void ContextImpl::wakeBackground()
+{
+    mWakePending.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> wakelock(mWakeMutex);
+    mWakeThread.notify_all();
+}
+
+bool ContextImpl::removeScheduledSource(SourceImpl *source)
+{
+    std::lock_guard<std::mutex> lock(mSourceStreamMutex);
+    return removeScheduledSourceNoLock(source);
+}
+
+bool ContextImpl::removeScheduledSourceNoLock(SourceImpl *source)
+{
+    auto iter = std::find_if(mScheduledSources.begin(), mScheduledSources.end(),
+        [source](const ScheduledSource &entry) -> bool
+        { return entry.mSource == source; }
+    );
+    if(iter == mScheduledSources.end())
+        return false;
+    mScheduledSources.erase(iter);
+    return true;
+}
+
+// Starts the scheduled sources that are due, and returns when the thread next
+// needs to wake up for them. Waiting on the condition variable isn't precise,
+// so the thread wakes a bit early and spins for sources that are almost due.
+std::chrono::steady_clock::time_point ContextImpl::startScheduledSources()
+{
+    static constexpr std::chrono::milliseconds SpinTime{2};
+
+    auto iter = mScheduledSources.begin();
+    for(;iter != mScheduledSources.end();++iter)
+    {
+        if(iter->mStartTime - std::chrono::steady_clock::now() > SpinTime)
+            break;
+        while(std::chrono::steady_clock::now() < iter->mStartTime)
+            std::this_thread::yield();
+        iter->mSource->startScheduled();
+    }
+    mScheduledSources.erase(mScheduledSources.begin(), iter);
+
+    if(mScheduledSources.empty())
+        return std::chrono::steady_clock::time_point::max();
+    return mScheduledSources.front().mStartTime - SpinTime;
 }
 
 
@@ -1628,6 +1937,18 @@ void ContextImpl::setDistanceModel(DistanceModel model)
 {
     CheckContext(this);
     alDistanceModel((ALenum)model);
+    mDistanceModel = model;
+}
+
+
+DECL_THUNK2(void, Context, setDistanceCulling,, bool, ALfloat)
+void ContextImpl::setDistanceCulling(bool enable, ALfloat threshold)
+{
+    if(!(threshold >= 0.0f))
+        throw std::out_of_range("Culling threshold out of range");
+    CheckContext(this);
+    mDistanceCulling = enable;
+    mCullThreshold = threshold;
 }
 
 
@@ -1635,33 +1956,72 @@ DECL_THUNK0(void, Context, update,)
 void ContextImpl::update()
 {
     CheckContext(this);
-    mPendingSources.erase(
-        std::remove_if(mPendingSources.begin(), mPendingSources.end(),
-            [](PendingSource &entry) -> bool
-            { return !entry.mSource->checkPending(entry.mFuture); }
-        ), mPendingSources.end()
+    UpdateList(mPendingSources, SourceList::Pending,
+        [](PendingSource &entry) -> bool
+        { return entry.mSource->checkPending(entry.mFuture); }
     );
     if(!mFadingSources.empty())
     {
         auto cur_time = mDevice.getClockTime();
-        mFadingSources.erase(
-            std::remove_if(mFadingSources.begin(), mFadingSources.end(),
-                [cur_time](SourceFadeUpdateEntry &entry) -> bool
-                { return !entry.mSource->fadeUpdate(cur_time, entry); }
-            ), mFadingSources.end()
+        mFadeGains.resize(mFadingSources.size());
+        CalcFadeGains(mFadingSources.data(), mFadingSources.size(), cur_time, mFadeGains.data());
+
+        // Go backwards so finished fades can be swapped out with entries that
+        // were already updated, keeping the gains lined up. The gain changes
+        // are deferred to be applied together.
+        Batcher batcher = getBatcher();
+        for(size_t i = mFadingSources.size();i > 0;)
+        {
+            --i;
+            const SourceFadeUpdateEntry &entry = mFadingSources[i];
+            SourceImpl *source = entry.mSource;
+            if(!source->fadeUpdate(entry, mFadeGains[i], cur_time >= entry.mFadeTimeTarget))
+            {
+                size_t cur = source->getListIndex(SourceList::Fading);
+                if(cur != InvalidListIdx)
+                    EraseListEntry(mFadingSources, SourceList::Fading, cur);
+            }
+        }
+    }
+
+    const ALfloat *gains = nullptr;
+    if(mDistanceCulling && (!mPlaySources.empty() || !mVirtualSources.empty()))
+    {
+        mCullGains.resize(mSourceProps.size());
+        mSourceProps.calcGains(mListener.getPosition(), mDistanceModel, mCullGains.data());
+        gains = mCullGains.data();
+    }
+    if(!mVirtualSources.empty())
+    {
+        // Once culling is disabled, every culled source gets a voice back.
+        const ALfloat threshold = mCullThreshold;
+        UpdateList(mVirtualSources, SourceList::Virtual,
+            [gains,threshold](SourceImpl *source) -> bool
+            {
+                bool audible = !gains || gains[source->getPropIndex()] > threshold;
+                return source->virtualUpdate(audible);
+            }
         );
     }
-    mPlaySources.erase(
-        std::remove_if(mPlaySources.begin(), mPlaySources.end(),
-            [](const SourceBufferUpdateEntry &entry) -> bool
-            { return !entry.mSource->playUpdate(entry.mId); }
-        ), mPlaySources.end()
+    UpdateList(mPlaySources, SourceList::Playing,
+        [this,gains](const SourceBufferUpdateEntry &entry) -> bool
+        {
+            SourceImpl *source = entry.mSource;
+            if(!source->playUpdate(entry.mId))
+                return false;
+            if(gains && gains[source->getPropIndex()] <= mCullThreshold &&
+               source->canVirtualize())
+            {
+                source->makeVirtual();
+                AddListEntry(mVirtualSources, SourceList::Virtual, source);
+                return false;
+            }
+            return true;
+        }
     );
-    mStreamSources.erase(
-        std::remove_if(mStreamSources.begin(), mStreamSources.end(),
-            [](const SourceStreamUpdateEntry &entry) -> bool
-            { return !entry.mSource->playUpdate(); }
-        ), mStreamSources.end()
+    UpdateList(mStreamSources, SourceList::Streaming,
+        [](const SourceStreamUpdateEntry &entry) -> bool
+        { return entry.mSource->playUpdate(); }
     );
 
     if(!mWakeInterval.load(std::memory_order_relaxed).count())
@@ -1683,6 +2043,13 @@ void ContextImpl::update()
 
 DECL_THUNK0(Device, Context, getDevice,)
 DECL_THUNK0(std::chrono::milliseconds, Context, getAsyncWakeInterval, const)
+DECL_THUNK0(std::chrono::milliseconds, Context, getStreamDecodeAhead, const)
+DECL_THUNK1(void, Context, setCallbackStreaming,, bool)
+DECL_THUNK0(bool, Context, getCallbackStreaming, const)
+DECL_THUNK0(uint64_t, Context, getUnderrunCount, const)
+DECL_THUNK0(UInt64Pair, Context, getStreamPoolStats, const)
+DECL_THUNK0(bool, Context, getDistanceCulling, const)
+DECL_THUNK0(ALfloat, Context, getDistanceCullingThreshold, const)
 DECL_THUNK0(Listener, Context, getListener,)
 DECL_THUNK0(SharedPtr<MessageHandler>, Context, getMessageHandler, const)
 
@@ -1718,6 +2085,9 @@ void ListenerImpl::set3DParameters(const Vector3 &position, const Vector3 &veloc
     alListenerfv(AL_POSITION, position.getPtr());
     alListenerfv(AL_VELOCITY, velocity.getPtr());
     alListenerfv(AL_ORIENTATION, orientation.first.getPtr());
+    mPosition[0] = position[0];
+    mPosition[1] = position[1];
+    mPosition[2] = position[2];
 }
 
 DECL_THUNK1(void, Listener, setPosition,, const Vector3&)
@@ -1725,6 +2095,9 @@ void ListenerImpl::setPosition(const Vector3 &position)
 {
     CheckContext(mContext);
     alListenerfv(AL_POSITION, position.getPtr());
+    mPosition[0] = position[0];
+    mPosition[1] = position[1];
+    mPosition[2] = position[2];
 }
 
 DECL_THUNK1(void, Listener, setPosition,, const ALfloat*)
@@ -1732,6 +2105,9 @@ void ListenerImpl::setPosition(const ALfloat *pos)
 {
     CheckContext(mContext);
     alListenerfv(AL_POSITION, pos);
+    mPosition[0] = pos[0];
+    mPosition[1] = pos[1];
+    mPosition[2] = pos[2];
 }
 
 DECL_THUNK1(void, Listener, setVelocity,, const Vector3&)
@@ -14,6 +14,8 @@
 
 #include "device.h"
 #include "source.h"
+#include "decodeahead.h"
+#include "shareddecoder.h"
 
 
 #define F_PI (3.14159265358979323846f)
@@ -35,6 +37,8 @@ enum class AL {
     SOFT_source_latency,
     SOFT_source_resampler,
     SOFT_source_spatialize,
+    SOFT_source_start_delay,
+    SOFT_callback_buffer,
 
     EXT_disconnect,
 
@@ -67,9 +71,13 @@ public:
 class ListenerImpl {
     ContextImpl *const mContext;
 
+    Vector3 mPosition{0.0f};
+
 public:
     ListenerImpl(ContextImpl *ctx) : mContext(ctx) { }
 
+    const Vector3 &getPosition() const { return mPosition; }
+
     void setGain(ALfloat gain);
 
     void set3DParameters(const Vector3 &position, const Vector3 &velocity, const std::pair<Vector3,Vector3> &orientation);
@@ -131,17 +139,43 @@ private:
     Vector<UniquePtr<SourceGroupImpl>> mSourceGroups;
     Vector<UniquePtr<AuxiliaryEffectSlotImpl>> mEffectSlots;
     Vector<UniquePtr<EffectImpl>> mEffects;
+    SourcePropStore mSourceProps;
+    // Declared before the sources, so it outlives their streams.
+    DecodeWorker mDecodeWorker;
+    std::atomic<std::chrono::milliseconds> mDecodeAhead{std::chrono::milliseconds(250)};
+    std::atomic<bool> mCallbackStreaming{false};
+    std::atomic<uint64_t> mUnderrunCount{0};
+    SharedPtr<StreamPool> mStreamPool{MakeShared<StreamPool>()};
+    // Shared streams, keyed by the decoder they read from.
+    std::unordered_map<Decoder*,WeakPtr<SharedDecodeStream>> mSharedStreams;
     std::deque<SourceImpl> mAllSources;
     Vector<SourceImpl*> mFreeSources;
 
     Vector<PendingSource> mPendingSources;
     Vector<SourceFadeUpdateEntry> mFadingSources;
+    Vector<ALfloat> mFadeGains;
     Vector<SourceBufferUpdateEntry> mPlaySources;
     Vector<SourceStreamUpdateEntry> mStreamSources;
+    // Culled sources that are playing without a voice.
+    Vector<SourceImpl*> mVirtualSources;
+    Vector<ALfloat> mCullGains;
+    ALfloat mCullThreshold{0.0f};
+    bool mDistanceCulling{false};
 
     Vector<SourceImpl*> mStreamingSources;
     std::mutex mSourceStreamMutex;
 
+    // Sources waiting for the background thread to start them, ordered by
+    // start time. Guarded by mSourceStreamMutex.
+    struct ScheduledSource {
+        SourceImpl *mSource;
+        std::chrono::steady_clock::time_point mStartTime;
+    };
+    Vector<ScheduledSource> mScheduledSources;
+    // Set to make the background thread update again before waiting.
+    std::atomic<bool> mWakePending{false};
+    std::chrono::steady_clock::time_point startScheduledSources();
+
     std::atomic<std::chrono::milliseconds> mWakeInterval{std::chrono::milliseconds::zero()};
     std::mutex mWakeMutex;
     std::condition_variable mWakeThread;
@@ -176,12 +210,17 @@ private:
 
     Vector<String> mResamplers;
 
+    DistanceModel mDistanceModel{DistanceModel::InverseClamped};
+
     Bitfield<static_cast<size_t>(AL::EXTENSION_MAX)> mHasExt;
 
     std::once_flag mSetExts;
     void setupExts();
 
-    DecoderOrExceptT findDecoder(StringView name);
+    // Buffer loads pass forbuffer, letting the default file factory map the
+    // file.
+    DecoderOrExceptT findDecoder(StringView name, bool forbuffer=false);
+    SharedPtr<Decoder> createBufferDecoder(StringView name);
     BufferOrExceptT doCreateBuffer(StringView name, size_t name_hash, BufferListT::const_iterator iter, SharedPtr<Decoder> decoder);
     BufferOrExceptT doCreateBufferAsync(StringView name, size_t name_hash, BufferListT::const_iterator iter, SharedPtr<Decoder> decoder, Promise<Buffer> promise);
 
@@ -202,6 +241,10 @@ public:
     LPALGETSOURCEI64VSOFT alGetSourcei64vSOFT{nullptr};
     LPALGETSOURCEDVSOFT alGetSourcedvSOFT{nullptr};
 
+    LPALSOURCEPLAYATTIMESOFT alSourcePlayAtTimeSOFT{nullptr};
+
+    LPALBUFFERCALLBACKSOFT alBufferCallbackSOFT{nullptr};
+
     LPALGENEFFECTS alGenEffects{nullptr};
     LPALDELETEEFFECTS alDeleteEffects{nullptr};
     LPALISEFFECT alIsEffect{nullptr};
@@ -241,13 +284,18 @@ public:
     FutureBufferListT::const_iterator findFutureBufferName(StringView name, size_t name_hash) const;
     BufferListT::const_iterator findBufferName(StringView name, size_t name_hash) const;
 
+    SourcePropStore &getSourceProps() { return mSourceProps; }
+    const ListenerImpl &getListenerImpl() const { return mListener; }
+    DistanceModel getDistanceModel() const { return mDistanceModel; }
+    DecodeWorker &getDecodeWorker() { return mDecodeWorker; }
+
     ALuint getSourceId(ALuint maxprio);
     void insertSourceId(ALuint id) { mSourceIds.push_back(id); }
 
     void addPendingSource(SourceImpl *source, SharedFuture<Buffer> future);
     void removePendingSource(SourceImpl *source);
     bool isPendingSource(const SourceImpl *source) const;
-    void addFadingSource(SourceImpl *source, std::chrono::nanoseconds duration, ALfloat gain);
+    void addFadingSource(const SourceFadeUpdateEntry &fade);
     void removeFadingSource(SourceImpl *source);
     void addPlayingSource(SourceImpl *source, ALuint id);
     void addPlayingSource(SourceImpl *source);
@@ -257,6 +305,11 @@ public:
     void removeStream(SourceImpl *source);
     void removeStreamNoLock(SourceImpl *source);
 
+    void addScheduledSource(SourceImpl *source, std::chrono::steady_clock::time_point start_time);
+    // Returns true if the source was still waiting to start.
+    bool removeScheduledSource(SourceImpl *source);
+    bool removeScheduledSourceNoLock(SourceImpl *source);
+
     void freeSource(SourceImpl *source) { mFreeSources.push_back(source); }
     void freeSourceGroup(SourceGroupImpl *group);
     void freeEffectSlot(AuxiliaryEffectSlotImpl *slot);
@@ -292,7 +345,25 @@ public:
     void setAsyncWakeInterval(std::chrono::milliseconds interval);
     std::chrono::milliseconds getAsyncWakeInterval() const { return mWakeInterval.load(); }
 
+    void setStreamDecodeAhead(std::chrono::milliseconds ahead);
+    std::chrono::milliseconds getStreamDecodeAhead() const { return mDecodeAhead.load(); }
+
+    void wakeBackground();
+
+    void setCallbackStreaming(bool enable) { mCallbackStreaming.store(enable); }
+    bool getCallbackStreaming() const { return mCallbackStreaming.load(); }
+
+    void addUnderrun() { mUnderrunCount.fetch_add(1, std::memory_order_relaxed); }
+    uint64_t getUnderrunCount() const { return mUnderrunCount.load(std::memory_order_relaxed); }
+
+    const SharedPtr<StreamPool> &getStreamPool() const { return mStreamPool; }
+    std::pair<uint64_t,uint64_t> getStreamPoolStats() const { return mStreamPool->getStats(); }
+
     SharedPtr<Decoder> createDecoder(StringView name);
+    SharedPtr<Decoder> createSharedDecoder(SharedPtr<Decoder>&& decoder);
+    SharedPtr<Decoder> prepareStream(StringView name, ALsizei chunk_len, ALsizei queue_size);
+    SharedPtr<Decoder> prepareStream(SharedPtr<Decoder>&& decoder, ALsizei chunk_len,
+                                     ALsizei queue_size);
 
     bool isSupported(ChannelConfig channels, SampleType type) const;
 
@@ -323,6 +394,10 @@ public:
 
     void setDistanceModel(DistanceModel model);
 
+    void setDistanceCulling(bool enable, ALfloat threshold);
+    bool getDistanceCulling() const { return mDistanceCulling; }
+    ALfloat getDistanceCullingThreshold() const { return mCullThreshold; }
+
     void update();
 };
 
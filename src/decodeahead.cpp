@@ -0,0 +1,431 @@
+
+#include "config.h"
+
+#include "decodeahead.h"
+
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <unordered_set>
+
+namespace alure {
+
+namespace {
+
+// How long the worker sleeps without being woken before checking the rings
+// anyway. wake() doesn't lock, so a wake can slip in between the worker
+// checking for one and sleeping; this bounds how long that can go unnoticed.
+constexpr auto MaxWorkerSleep = std::chrono::milliseconds(20);
+
+// The live PreparedDecoders, to recognize them with.
+std::mutex gPreparedLock;
+std::unordered_set<const Decoder*> gPreparedDecoders;
+
+} // namespace
+
+DecodeAhead::DecodeAhead(SharedPtr<Decoder> decoder, ALuint framesize, ALsizei chunklen,
+                         size_t numchunks, std::pair<uint64_t,uint64_t> looppts,
+                         SharedPtr<StreamPool> pool)
+  : mDecoder(std::move(decoder)), mFrameSize(framesize), mChunkLen(chunklen)
+  , mFrequency(mDecoder->getFrequency()), mChannels(mDecoder->getChannelConfig())
+  , mSampleType(mDecoder->getSampleType()), mLoopPts(looppts), mPool(std::move(pool))
+{
+    size_t size = numchunks * chunklen * framesize;
+    if(mPool)
+        mData = mPool->getStaging(size);
+    else
+        mData.resize(size);
+    mChunks.resize(numchunks);
+}
+
+DecodeAhead::~DecodeAhead()
+{
+    if(mPool)
+        mPool->putStaging(std::move(mData));
+}
+
+ALsizei DecodeAhead::decodeChunk(ALbyte *dst, bool &looped)
+{
+    bool loop = mLooping.load(std::memory_order_relaxed);
+    ALsizei len = mChunkLen;
+    if(loop && mDecodePos < mLoopPts.second)
+        len = static_cast<ALsizei>(std::min<uint64_t>(len, mLoopPts.second - mDecodePos));
+    else
+        loop = false;
+
+    ALsizei frames = mDecoder->read(dst, len);
+    mDecodePos += frames;
+    if(loop && ((frames < mChunkLen && mDecodePos > 0) || (mDecodePos == mLoopPts.second)))
+    {
+        if(mDecodePos < mLoopPts.second)
+        {
+            mLoopPts.second = mDecodePos;
+            if(mLoopPts.first >= mLoopPts.second)
+                mLoopPts.first = 0;
+        }
+
+        do {
+            if(!mDecoder->seek(mLoopPts.first))
+            {
+                len = mChunkLen-frames;
+                if(len > 0)
+                {
+                    ALuint got = mDecoder->read(&dst[frames*mFrameSize], len);
+                    mDecodePos += got;
+                    frames += got;
+                }
+                break;
+            }
+            mDecodePos = mLoopPts.first;
+            looped = true;
+
+            len = static_cast<ALsizei>(
+                std::min<uint64_t>(mChunkLen-frames, mLoopPts.second-mLoopPts.first)
+            );
+            if(len == 0) break;
+            ALuint got = mDecoder->read(&dst[frames*mFrameSize], len);
+            if(got == 0) break;
+            mDecodePos += got;
+            frames += got;
+        } while(frames < mChunkLen);
+    }
+
+    // Continue with the next decoder in the rest of the chunk, so the change
+    // is sample-exact.
+    while(frames < mChunkLen && !mNext.empty() && canContinueWith(*mNext.front()))
+    {
+        switchDecoder(std::move(mNext.front()));
+        mNext.pop_front();
+
+        ALuint got = mDecoder->read(&dst[frames*mFrameSize], mChunkLen-frames);
+        mDecodePos += got;
+        frames += got;
+    }
+    return frames;
+}
+
+bool DecodeAhead::canContinueWith(const Decoder &decoder) const
+{
+    return decoder.getFrequency() == mFrequency && decoder.getChannelConfig() == mChannels &&
+           decoder.getSampleType() == mSampleType;
+}
+
+void DecodeAhead::switchDecoder(SharedPtr<Decoder> decoder)
+{
+    mDecoder = std::move(decoder);
+    mDecodePos = 0;
+    mLoopPts = mDecoder->getLoopPoints();
+    if(mLoopPts.first >= mLoopPts.second)
+    {
+        mLoopPts.first = 0;
+        mLoopPts.second = std::numeric_limits<uint64_t>::max();
+    }
+    mNewTrack = true;
+}
+
+void DecodeAhead::setLooping(bool looping)
+{
+    if(mLooping.exchange(looping, std::memory_order_relaxed) == looping || !looping)
+        return;
+
+    std::unique_lock<std::mutex> lock(mDecoderMutex);
+    if(!mFinished.load(std::memory_order_relaxed) || !mNext.empty())
+        return;
+
+    // The decoder ended while not looping, so nothing more would be decoded.
+    // Go back to the loop start, treating the end as the loop end if it came
+    // first, as decodeChunk would have.
+    if(mDecodePos < mLoopPts.second)
+    {
+        mLoopPts.second = mDecodePos;
+        if(mLoopPts.first >= mLoopPts.second)
+            mLoopPts.first = 0;
+    }
+    if(mLoopPts.second == 0 || !mDecoder->seek(mLoopPts.first))
+        return;
+    mDecodePos = mLoopPts.first;
+    mLoopRestart = true;
+    mFinished.store(false, std::memory_order_release);
+    lock.unlock();
+    if(mWorker) mWorker->wake();
+}
+
+void DecodeAhead::attach(DecodeWorker *worker)
+{
+    std::lock_guard<std::mutex> lock(mDecoderMutex);
+    mDetached = false;
+    mWorker = worker;
+}
+
+void DecodeAhead::detach()
+{
+    std::lock_guard<std::mutex> lock(mDecoderMutex);
+    mDetached = true;
+}
+
+bool DecodeAhead::fill(bool byworker)
+{
+    std::lock_guard<std::mutex> lock(mDecoderMutex);
+    if(mFinished.load(std::memory_order_relaxed) || (byworker && mDetached))
+        return false;
+
+    size_t write = mWriteCount.load(std::memory_order_relaxed);
+    if(write - mReadCount.load(std::memory_order_acquire) >= mChunks.size())
+        return false;
+
+    size_t idx = write % mChunks.size();
+    bool looped = mLoopRestart;
+    mLoopRestart = false;
+    ALsizei frames = decodeChunk(&mData[idx * mChunkLen * mFrameSize], looped);
+    if(frames > 0)
+    {
+        ChunkInfo &info = mChunks[idx];
+        info.mFrames = frames;
+        info.mEndPos = mDecodePos;
+        info.mLoopPts = mLoopPts;
+        info.mLooped = looped;
+        info.mNewTrack = mNewTrack;
+        mNewTrack = false;
+        mWriteCount.store(write+1, std::memory_order_release);
+    }
+    if(frames < mChunkLen)
+        mFinished.store(true, std::memory_order_release);
+    return frames > 0;
+}
+
+bool DecodeAhead::seek(uint64_t pos)
+{
+    std::lock_guard<std::mutex> lock(mDecoderMutex);
+    if(!mDecoder->seek(pos))
+        return false;
+    mDecodePos = pos;
+    mLoopRestart = false;
+    mReadCount.store(0, std::memory_order_relaxed);
+    mWriteCount.store(0, std::memory_order_relaxed);
+    mFinished.store(false, std::memory_order_release);
+    return true;
+}
+
+bool DecodeAhead::front(Chunk &chunk) const
+{
+    size_t read = mReadCount.load(std::memory_order_relaxed);
+    if(mWriteCount.load(std::memory_order_acquire) == read)
+        return false;
+
+    size_t idx = read % mChunks.size();
+    const ChunkInfo &info = mChunks[idx];
+    chunk.mData = &mData[idx * mChunkLen * mFrameSize];
+    chunk.mFrames = info.mFrames;
+    chunk.mEndPos = info.mEndPos;
+    chunk.mLoopPts = info.mLoopPts;
+    chunk.mLooped = info.mLooped;
+    chunk.mNewTrack = info.mNewTrack;
+    return true;
+}
+
+void DecodeAhead::queueNext(SharedPtr<Decoder> decoder)
+{
+    std::unique_lock<std::mutex> lock(mDecoderMutex);
+    if(mFinished.load(std::memory_order_relaxed) && mNext.empty() && canContinueWith(*decoder))
+    {
+        // The current decoder already ended, so start the new one with the
+        // next chunk.
+        switchDecoder(std::move(decoder));
+        mFinished.store(false, std::memory_order_release);
+        lock.unlock();
+        if(mWorker) mWorker->wake();
+    }
+    else
+        mNext.push_back(std::move(decoder));
+}
+
+std::deque<SharedPtr<Decoder>> DecodeAhead::takeNext()
+{
+    std::lock_guard<std::mutex> lock(mDecoderMutex);
+    std::deque<SharedPtr<Decoder>> next;
+    next.swap(mNext);
+    return next;
+}
+
+void DecodeAhead::pop()
+{
+    mReadCount.store(mReadCount.load(std::memory_order_relaxed)+1, std::memory_order_release);
+    if(mWorker) mWorker->wake();
+}
+
+
+DecodeWorker::~DecodeWorker()
+{
+    if(mThread.joinable())
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mQuit.store(true, std::memory_order_release);
+        lock.unlock();
+        mWake.notify_all();
+        mThread.join();
+    }
+    // Prepared decoders may still be holding streams.
+    for(auto &stream : mStreams)
+        stream->setWorker(nullptr);
+}
+
+void DecodeWorker::add(SharedPtr<DecodeAhead> stream)
+{
+    stream->attach(this);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(std::find(mStreams.begin(), mStreams.end(), stream) == mStreams.end())
+        mStreams.push_back(std::move(stream));
+    if(mThread.get_id() == std::thread::id())
+        mThread = std::thread(std::mem_fn(&DecodeWorker::run), this);
+    mWakePending.store(true, std::memory_order_release);
+    mWake.notify_all();
+}
+
+void DecodeWorker::remove(DecodeAhead *stream)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto iter = std::find_if(mStreams.begin(), mStreams.end(),
+            [stream](const SharedPtr<DecodeAhead> &entry) -> bool
+            { return entry.get() == stream; }
+        );
+        if(iter != mStreams.end())
+        {
+            std::swap(*iter, mStreams.back());
+            mStreams.pop_back();
+        }
+    }
+
+    // The thread may still have it in the list it's going through, and be in
+    // the middle of filling it.
+    stream->detach();
+}
+
+void DecodeWorker::wake()
+{
+    if(!mWakePending.exchange(true, std::memory_order_acq_rel))
+        mWake.notify_all();
+}
+
+void DecodeWorker::run()
+{
+    Vector<SharedPtr<DecodeAhead>> streams;
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(!mQuit.load(std::memory_order_acquire))
+    {
+        mWakePending.store(false, std::memory_order_release);
+        streams = mStreams;
+        lock.unlock();
+
+        // Give each stream a chunk in turn, so one slow decoder doesn't hold
+        // up the others more than necessary.
+        bool progress;
+        do {
+            progress = false;
+            for(const auto &stream : streams)
+                progress |= stream->fill(true);
+        } while(progress && !mQuit.load(std::memory_order_acquire));
+        streams.clear();
+
+        lock.lock();
+        // Drop streams nothing else holds anymore, like unused prepared
+        // decoders.
+        mStreams.erase(std::remove_if(mStreams.begin(), mStreams.end(),
+            [](const SharedPtr<DecodeAhead> &entry) -> bool
+            { return entry.use_count() == 1; }
+        ), mStreams.end());
+        mWake.wait_for(lock, MaxWorkerSleep, [this]() -> bool
+            {
+                return mWakePending.load(std::memory_order_acquire) ||
+                       mQuit.load(std::memory_order_acquire);
+            }
+        );
+    }
+}
+
+
+
+PreparedDecoder::PreparedDecoder(SharedPtr<Decoder> decoder, SharedPtr<DecodeAhead> ahead,
+                                 ALuint framesize)
+  : mDecoder(std::move(decoder)), mAhead(std::move(ahead)), mFrameSize(framesize)
+{
+    std::lock_guard<std::mutex> lock(gPreparedLock);
+    gPreparedDecoders.insert(this);
+}
+
+PreparedDecoder::~PreparedDecoder()
+{
+    {
+        std::lock_guard<std::mutex> lock(gPreparedLock);
+        gPreparedDecoders.erase(this);
+    }
+    if(mAhead)
+    {
+        if(DecodeWorker *worker = mAhead->getWorker())
+            worker->remove(mAhead.get());
+    }
+}
+
+PreparedDecoder *PreparedDecoder::Get(Decoder *decoder)
+{
+    std::lock_guard<std::mutex> lock(gPreparedLock);
+    if(gPreparedDecoders.find(decoder) == gPreparedDecoders.end())
+        return nullptr;
+    return static_cast<PreparedDecoder*>(decoder);
+}
+
+SharedPtr<DecodeAhead> PreparedDecoder::takeAhead(ALsizei chunklen)
+{
+    if(!mAhead || !mUntouched || mAhead->getChunkLength() != chunklen)
+        return nullptr;
+    return std::move(mAhead);
+}
+
+bool PreparedDecoder::seek(uint64_t pos) noexcept
+{
+    // Once a stream has taken the ring and finished with it, the decoder can
+    // be played again from the wrapped decoder.
+    if(!mAhead) return mDecoder->seek(pos);
+    if(!mAhead->seek(pos))
+        return false;
+    mChunkOffset = 0;
+    mUntouched = false;
+    return true;
+}
+
+ALuint PreparedDecoder::read(ALvoid *ptr, ALuint count) noexcept
+{
+    if(!mAhead) return mDecoder->read(ptr, count);
+    mUntouched = false;
+
+    ALbyte *dst = static_cast<ALbyte*>(ptr);
+    ALuint total = 0;
+    while(total < count)
+    {
+        DecodeAhead::Chunk chunk;
+        if(!mAhead->front(chunk))
+        {
+            // Decode here if the worker hasn't gotten to it.
+            if(mAhead->isFinished() || (!mAhead->fill() && mAhead->getReadyCount() == 0))
+                break;
+            continue;
+        }
+
+        ALuint todo = std::min<ALuint>(count-total, chunk.mFrames-mChunkOffset);
+        memcpy(dst + total*mFrameSize, chunk.mData + mChunkOffset*mFrameSize,
+               todo*mFrameSize);
+        total += todo;
+        mChunkOffset += todo;
+        if(mChunkOffset == chunk.mFrames)
+        {
+            mChunkOffset = 0;
+            mAhead->pop();
+        }
+    }
+    return total;
+}
+
+} // namespace alure
@@ -0,0 +1,201 @@
+#ifndef DECODEAHEAD_H
+#define DECODEAHEAD_H
+
+#include "main.h"
+#include "streampool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+namespace alure {
+
+class DecodeWorker;
+
+// Decodes a stream into a ring of fixed-size PCM chunks, ahead of when they're
+// needed. One thread at a time fills the ring while holding the decoder lock,
+// and the stream's owner takes chunks off the front without locking.
+class DecodeAhead {
+public:
+    struct Chunk {
+        const ALbyte *mData;
+        ALsizei mFrames;
+        // The decoder position after the chunk, and the loop points it was
+        // decoded with.
+        uint64_t mEndPos;
+        std::pair<uint64_t,uint64_t> mLoopPts;
+        bool mLooped;
+        // Set when the chunk includes the start of a queued decoder.
+        bool mNewTrack;
+    };
+
+private:
+    struct ChunkInfo {
+        ALsizei mFrames{0};
+        uint64_t mEndPos{0};
+        std::pair<uint64_t,uint64_t> mLoopPts{0,0};
+        bool mLooped{false};
+        bool mNewTrack{false};
+    };
+
+    SharedPtr<Decoder> mDecoder;
+    std::mutex mDecoderMutex;
+
+    const ALuint mFrameSize;
+    const ALsizei mChunkLen;
+    const ALuint mFrequency;
+    const ChannelConfig mChannels;
+    const SampleType mSampleType;
+
+    // Decoder state, guarded by mDecoderMutex.
+    uint64_t mDecodePos{0};
+    std::pair<uint64_t,uint64_t> mLoopPts;
+    // Decoders to continue with when the current one ends.
+    std::deque<SharedPtr<Decoder>> mNext;
+    bool mNewTrack{false};
+    // Set when looping restarted the decoder after it ended, for the next
+    // chunk to be marked as looped.
+    bool mLoopRestart{false};
+
+    // Set once the stream is removed from its worker, so the worker stops
+    // filling it. Guarded by mDecoderMutex.
+    bool mDetached{false};
+
+    std::atomic<bool> mLooping{false};
+    std::atomic<bool> mFinished{false};
+
+    Vector<ALbyte> mData;
+    Vector<ChunkInfo> mChunks;
+    std::atomic<size_t> mWriteCount{0};
+    std::atomic<size_t> mReadCount{0};
+
+    DecodeWorker *mWorker{nullptr};
+    SharedPtr<StreamPool> mPool;
+
+    ALsizei decodeChunk(ALbyte *dst, bool &looped);
+    bool canContinueWith(const Decoder &decoder) const;
+    void switchDecoder(SharedPtr<Decoder> decoder);
+
+public:
+    DecodeAhead(SharedPtr<Decoder> decoder, ALuint framesize, ALsizei chunklen, size_t numchunks,
+                std::pair<uint64_t,uint64_t> looppts, SharedPtr<StreamPool> pool);
+    ~DecodeAhead();
+
+    void setWorker(DecodeWorker *worker) { mWorker = worker; }
+    DecodeWorker *getWorker() const { return mWorker; }
+
+    // Lets the worker fill the ring, or stops it from filling it. Detaching
+    // waits for a chunk the worker is in the middle of decoding.
+    void attach(DecodeWorker *worker);
+    void detach();
+
+    ALsizei getChunkLength() const { return mChunkLen; }
+
+    // Sets whether the decoder loops. Turning looping on after the decoder
+    // ended without it, as with a prepared decoder, restarts it from the loop
+    // start.
+    void setLooping(bool looping);
+
+    // Decodes one chunk into the ring, if there's room and the decoder has
+    // more. Returns true if a chunk was added. The worker passes true, to
+    // skip streams that were detached from it.
+    bool fill(bool byworker=false);
+
+    // Flushes the ring and seeks the decoder.
+    bool seek(uint64_t pos);
+
+    // Queues a decoder to continue from once the current one ends. Decoders
+    // with the same format are continued in the same chunk, without a gap.
+    // Otherwise, the ring finishes, leaving the rest for takeNext.
+    void queueNext(SharedPtr<Decoder> decoder);
+    std::deque<SharedPtr<Decoder>> takeNext();
+
+    // Gets the next ready chunk. Returns false if there isn't one.
+    bool front(Chunk &chunk) const;
+    void pop();
+
+    size_t getReadyCount() const
+    {
+        return mWriteCount.load(std::memory_order_acquire) -
+               mReadCount.load(std::memory_order_relaxed);
+    }
+    size_t getCapacity() const { return mChunks.size(); }
+
+    // True once the decoder has ended and every chunk has been taken.
+    bool isFinished() const
+    {
+        return mFinished.load(std::memory_order_acquire) && getReadyCount() == 0;
+    }
+};
+
+
+// Runs a thread that keeps the registered streams' rings filled, so decoding
+// doesn't delay the buffer queueing.
+class DecodeWorker {
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    // Set without the lock by wake(), which is called from the mixer.
+    std::atomic<bool> mWakePending{false};
+    std::atomic<bool> mQuit{false};
+
+    Vector<SharedPtr<DecodeAhead>> mStreams;
+    std::thread mThread;
+
+    void run();
+
+public:
+    ~DecodeWorker();
+
+    // Registers a stream, if it isn't already.
+    void add(SharedPtr<DecodeAhead> stream);
+    // Unregisters a stream. Once this returns, the thread won't touch the
+    // stream's decoder again.
+    void remove(DecodeAhead *stream);
+    // Asks the thread to check the rings again. This doesn't lock or wait, so
+    // it's safe to call from the mixer's callback.
+    void wake();
+};
+
+
+// A decoder whose first chunks are decoded in the background, for a stream
+// to take over and start playing without waiting on the decoder. Until then,
+// it reads from the prepared chunks. Once taken over, it reads the wrapped
+// decoder directly, like any other decoder.
+class PreparedDecoder final : public Decoder {
+    SharedPtr<Decoder> mDecoder;
+    SharedPtr<DecodeAhead> mAhead;
+    ALuint mFrameSize;
+    ALsizei mChunkOffset{0};
+    bool mUntouched{true};
+
+public:
+    PreparedDecoder(SharedPtr<Decoder> decoder, SharedPtr<DecodeAhead> ahead, ALuint framesize);
+    ~PreparedDecoder() override;
+
+    // Returns the decoder as a PreparedDecoder if it is one, or nullptr. This
+    // avoids needing RTTI for dynamic_cast.
+    static PreparedDecoder *Get(Decoder *decoder);
+
+    // Hands over the decode-ahead ring if it was prepared with the given
+    // chunk length and hasn't been read from. Returns nullptr otherwise.
+    SharedPtr<DecodeAhead> takeAhead(ALsizei chunklen);
+
+    ALuint getFrequency() const noexcept override { return mDecoder->getFrequency(); }
+    ChannelConfig getChannelConfig() const noexcept override
+    { return mDecoder->getChannelConfig(); }
+    SampleType getSampleType() const noexcept override { return mDecoder->getSampleType(); }
+
+    uint64_t getLength() const noexcept override { return mDecoder->getLength(); }
+    bool seek(uint64_t pos) noexcept override;
+
+    std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override
+    { return mDecoder->getLoopPoints(); }
+
+    ALuint read(ALvoid *ptr, ALuint count) noexcept override;
+};
+
+} // namespace alure
+
+#endif /* DECODEAHEAD_H */
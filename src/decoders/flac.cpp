@@ -6,6 +6,7 @@
 #include <cstring>
 
 #include "main.h"
+#include "bytesource.h"
 
 #define DR_FLAC_NO_STDIO
 #define DR_FLAC_IMPLEMENTATION
@@ -25,7 +26,8 @@ using FlacFilePtr = alure::UniquePtr<drflac,FlacFileDeleter>;
 namespace alure {
 
 class FlacDecoder final : public Decoder {
-    UniquePtr<std::istream> mFile;
+    SharedPtr<std::istream> mFile;
+    UniquePtr<ByteSource> mSource;
 
     FlacFilePtr mFlacFile;
     ChannelConfig mChannelConfig{ChannelConfig::Mono};
@@ -105,19 +107,13 @@ class FlacDecoder final : public Decoder {
 
     static size_t ReadCallback(void *client_data, void *buffer, size_t bytes)
     {
-        std::istream *stream = static_cast<FlacDecoder*>(client_data)->mFile.get();
-        stream->clear();
-
-        stream->read(reinterpret_cast<char*>(buffer), bytes);
-        return stream->gcount();
+        ByteSource *source = static_cast<FlacDecoder*>(client_data)->mSource.get();
+        return source->read(buffer, bytes);
     }
     static drflac_bool32 SeekCallback(void *client_data, int offset, drflac_seek_origin origin)
     {
-        std::istream *stream = static_cast<FlacDecoder*>(client_data)->mFile.get();
-        stream->clear();
-
-        if(!stream->seekg(offset, (origin==drflac_seek_origin_current) ? std::ios_base::cur
-                                                                       : std::ios_base::beg))
+        ByteSource *source = static_cast<FlacDecoder*>(client_data)->mSource.get();
+        if(!source->seek(offset, (origin==drflac_seek_origin_current) ? SEEK_CUR : SEEK_SET))
             return DRFLAC_FALSE;
         return DRFLAC_TRUE;
     }
@@ -138,22 +134,27 @@ public:
     std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override;
 
     ALuint read(ALvoid *ptr, ALuint count) noexcept override;
+
+    SharedPtr<Decoder> cloneAt(uint64_t pos) const noexcept override;
 };
 
 
 bool FlacDecoder::open(UniquePtr<std::istream> &file) noexcept
 {
-    mFile = std::move(file);
+    mSource = MakeByteSource(*file);
     mFlacFile = FlacFilePtr(drflac_open_with_metadata(ReadCallback, SeekCallback, MetadataCallback, this));
     if(mFlacFile)
     {
         if(mFrequency != 0)
+        {
+            mFile = std::move(file);
             return true;
+        }
 
         mFlacFile = nullptr;
     }
 
-    file = std::move(mFile);
+    mSource = nullptr;
     return false;
 }
 
@@ -206,6 +207,37 @@ ALuint FlacDecoder::read(ALvoid *ptr, ALuint count) noexcept
     return count / mFlacFile->channels;
 }
 
+SharedPtr<Decoder> FlacDecoder::cloneAt(uint64_t pos) const noexcept
+{
+    ArrayView<ALbyte> view = mSource->getView();
+    if(view.empty()) return nullptr;
+
+    // The format was already chosen, so the clone skips the metadata.
+    auto decoder = MakeShared<FlacDecoder>();
+    decoder->mSource = MakeByteSource(view);
+    decoder->mFlacFile = FlacFilePtr(drflac_open(ReadCallback, SeekCallback, decoder.get()));
+    if(!decoder->mFlacFile || decoder->mFlacFile->channels != mFlacFile->channels)
+        return nullptr;
+    decoder->mFile = mFile;
+    decoder->mChannelConfig = mChannelConfig;
+    decoder->mSampleType = mSampleType;
+    decoder->mFrequency = mFrequency;
+    decoder->mLoopPts = mLoopPts;
+    if(!decoder->seek(pos)) return nullptr;
+    return decoder;
+}
+
+
+SignatureMatch FlacDecoderFactory::checkSignature(ArrayView<ALbyte> header) const noexcept
+{
+    if(header.size() >= 4 && memcmp(header.data(), "fLaC", 4) == 0)
+        return SignatureMatch::Match;
+    // dr_flac also skips ID3 tags and handles FLAC in Ogg.
+    if(header.size() >= 4 && (memcmp(header.data(), "ID3", 3) == 0 ||
+                              memcmp(header.data(), "OggS", 4) == 0))
+        return SignatureMatch::Unknown;
+    return SignatureMatch::NoMatch;
+}
 
 SharedPtr<Decoder> FlacDecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
@@ -7,6 +7,7 @@ namespace alure {
 
 class FlacDecoderFactory final : public DecoderFactory {
     SharedPtr<Decoder> createDecoder(UniquePtr<std::istream> &file) noexcept override;
+    SignatureMatch checkSignature(ArrayView<ALbyte> header) const noexcept override;
 };
 
 } // namespace alure
@@ -2,10 +2,14 @@
 #include "mp3.hpp"
 
 #include <stdexcept>
+#include <algorithm>
 #include <iostream>
 #include <cassert>
+#include <deque>
 
 #include "context.h"
+#include "sampleconv.h"
+#include "bytesource.h"
 
 #define MINIMP3_IMPLEMENTATION
 #define MINIMP3_FLOAT_OUTPUT
@@ -16,23 +20,66 @@ namespace {
 constexpr size_t MinMp3DataSize = 16384;
 constexpr size_t MaxMp3DataSize = MinMp3DataSize * 8;
 
-size_t append_file_data(std::istream &file, alure::Vector<uint8_t> &data, size_t count)
+// Every this many frames is added to the seek index.
+constexpr uint64_t FrameIndexInterval = 16;
+// The most bytes a layer III frame's data may start before its header, due
+// to the bit reservoir. Seeks decode at least this much before the target.
+constexpr size_t MaxReservoirBytes = 511;
+
+// Buffered file data, read from the front of the [mPos, mEnd) range of the
+// storage. Taking a frame off the front doesn't move the rest of the buffer,
+// and the unconsumed data is only moved back to the start of the storage once
+// the space after it runs out.
+class Mp3FileData {
+    alure::Vector<uint8_t> mData;
+    size_t mPos{0};
+    size_t mEnd{0};
+
+public:
+    const uint8_t *data() const { return mData.data() + mPos; }
+    size_t size() const { return mEnd - mPos; }
+    const uint8_t &operator[](size_t i) const { return mData[mPos + i]; }
+
+    void consume(size_t count) { mPos += std::min(count, size()); }
+    void clear() { mPos = mEnd = 0; }
+
+    // Makes room for count more bytes at the end. Returns a pointer to the
+    // new space.
+    uint8_t *extend(size_t count)
+    {
+        if(mData.size() - mEnd < count)
+        {
+            size_t len = mEnd - mPos;
+            if(mPos > 0)
+                memmove(mData.data(), mData.data()+mPos, len);
+            mPos = 0;
+            mEnd = len;
+            // Leave room for several refills, so this is rarely needed.
+            if(mData.size() - mEnd < count)
+                mData.resize(std::max(mEnd + count, MinMp3DataSize*4));
+        }
+        uint8_t *dst = mData.data() + mEnd;
+        mEnd += count;
+        return dst;
+    }
+    void shrink(size_t count) { mEnd -= count; }
+};
+
+size_t append_file_data(alure::ByteSource &file, Mp3FileData &data, size_t count)
 {
     size_t old_size = data.size();
     if(old_size >= MaxMp3DataSize || count == 0)
         return 0;
     count = std::min(count, MaxMp3DataSize - old_size);
-    data.resize(old_size + count);
+    uint8_t *dst = data.extend(count);
 
-    file.clear();
-    file.read(reinterpret_cast<char*>(data.data()+old_size), count);
-    size_t got = file.gcount();
-    data.resize(old_size + got);
+    size_t got = file.read(dst, count);
+    data.shrink(count - got);
 
     return got;
 }
 
-size_t find_i3dv2(alure::ArrayView<uint8_t> data)
+size_t find_i3dv2(const Mp3FileData &data)
 {
     if(data.size() > 10 && memcmp(data.data(), "ID3", 3) == 0)
         return (((data[6]&0x7f) << 21) | ((data[7]&0x7f) << 14) |
@@ -40,18 +87,30 @@ size_t find_i3dv2(alure::ArrayView<uint8_t> data)
     return 0;
 }
 
-int decode_frame(std::istream &file, mp3dec_t &mp3, alure::Vector<uint8_t> &file_data,
-                 float *sample_data, mp3dec_frame_info_t *frame_info)
+// Drops count bytes of file data, skipping over the file if there isn't that
+// much buffered.
+void skip_file_data(alure::ByteSource &file, Mp3FileData &file_data, size_t count)
 {
-    if(file_data.size() < MinMp3DataSize && !file.eof())
+    if(file_data.size() >= count)
+        file_data.consume(count);
+    else
     {
-        size_t todo = MinMp3DataSize - file_data.size();
-        append_file_data(file, file_data, todo);
+        file.skip(count - file_data.size());
+        file_data.clear();
     }
+}
+
+int decode_frame(alure::ByteSource &file, mp3dec_t &mp3, Mp3FileData &file_data,
+                 float *sample_data, mp3dec_frame_info_t *frame_info)
+{
+    // Refill a whole block at a time, rather than topping up after every
+    // frame.
+    if(file_data.size() < MinMp3DataSize)
+        append_file_data(file, file_data, MinMp3DataSize);
 
     int samples_to_get = mp3dec_decode_frame(&mp3, file_data.data(), file_data.size(),
                                              sample_data, frame_info);
-    while(samples_to_get == 0 && !file.eof())
+    while(samples_to_get == 0)
     {
         if(append_file_data(file, file_data, MinMp3DataSize) == 0)
             break;
@@ -61,6 +120,81 @@ int decode_frame(std::istream &file, mp3dec_t &mp3, alure::Vector<uint8_t> &file
     return samples_to_get;
 }
 
+// Decoders add this many samples of delay to the start of the stream, which
+// the LAME tag's encoder delay doesn't include.
+constexpr uint64_t DecoderDelay = 529;
+
+// The stream details given by a Xing, Info or VBRI header, which encoders put
+// in an otherwise silent first frame.
+struct Mp3StreamInfo {
+    uint64_t mFrames{0};
+    uint64_t mFrameSamples{0};
+    uint64_t mDelay{0};
+    uint64_t mPadding{0};
+    bool mHasFrames{false};
+    bool mHasGapless{false};
+};
+
+inline uint32_t read_be32(const uint8_t *data)
+{ return (uint32_t(data[0])<<24) | (uint32_t(data[1])<<16) | (uint32_t(data[2])<<8) | data[3]; }
+
+// Checks the frame at the start of the data for an info header. Returns true
+// if it has one, meaning the frame should be skipped.
+bool parse_info_frame(const uint8_t *data, size_t size, Mp3StreamInfo &info)
+{
+    if(size < 4 || data[0] != 0xff || (data[1]&0xe0) != 0xe0)
+        return false;
+
+    const bool mpeg1 = (data[1]&0x18) == 0x18;
+    const int layer = 4 - ((data[1]>>1)&3);
+    const bool has_crc = !(data[1]&1);
+    const bool mono = (data[3]>>6) == 3;
+    if(layer != 3) return false;
+    info.mFrameSamples = mpeg1 ? 1152 : 576;
+
+    // The Xing/Info header follows the side info.
+    size_t offset = 4 + (has_crc ? 2 : 0) + (mpeg1 ? (mono ? 17 : 32) : (mono ? 9 : 17));
+    if(size >= offset+8 && (memcmp(data+offset, "Xing", 4) == 0 ||
+                            memcmp(data+offset, "Info", 4) == 0))
+    {
+        const uint32_t flags = read_be32(data+offset+4);
+        offset += 8;
+        if((flags&0x1))
+        {
+            if(size < offset+4) return true;
+            info.mFrames = read_be32(data+offset);
+            info.mHasFrames = true;
+            offset += 4;
+        }
+        if((flags&0x2)) offset += 4;
+        if((flags&0x4)) offset += 100;
+        if((flags&0x8)) offset += 4;
+
+        // A LAME extension has the encoder delay and padding, as two 12-bit
+        // values at byte 21.
+        if(size >= offset+24 && (memcmp(data+offset, "LAME", 4) == 0 ||
+                                 memcmp(data+offset, "Lavc", 4) == 0 ||
+                                 memcmp(data+offset, "Lavf", 4) == 0))
+        {
+            const uint8_t *delay = data+offset+21;
+            info.mDelay = (uint64_t(delay[0])<<4) | (delay[1]>>4);
+            info.mPadding = (uint64_t(delay[1]&0x0f)<<8) | delay[2];
+            info.mHasGapless = info.mHasFrames;
+        }
+        return true;
+    }
+
+    // A VBRI header is always at the same place.
+    offset = 4 + 32;
+    if(size >= offset+18 && memcmp(data+offset, "VBRI", 4) == 0)
+    {
+        info.mFrames = read_be32(data+offset+14);
+        info.mHasFrames = true;
+        return true;
+    }
+    return false;
+}
+
 } // namespace
 
 
@@ -68,11 +202,14 @@ namespace alure {
 
 class Mp3Decoder final : public Decoder {
     UniquePtr<std::istream> mFile;
+    UniquePtr<ByteSource> mSource;
 
-    Vector<uint8_t> mFileData;
+    Mp3FileData mFileData;
 
     mp3dec_t mMp3;
+    // Decoded samples not yet read, from mSampleOffset on.
     Vector<float> mSampleData;
+    size_t mSampleOffset{0};
     mp3dec_frame_info_t mLastFrame{};
     mutable std::mutex mMutex;
 
@@ -81,13 +218,56 @@ class Mp3Decoder final : public Decoder {
     SampleType mSampleType{SampleType::UInt8};
     int mSampleRate{0};
 
+    // Decoded samples to drop from the start and past the end, from the LAME
+    // tag's encoder delay and padding. Positions past the decoder are offset
+    // by the start trim, and mEndPos is UINT64_MAX if there's no end trim.
+    uint64_t mStartTrim{0};
+    uint64_t mEndPos{std::numeric_limits<uint64_t>::max()};
+    uint64_t mCurPos{0};
+
+    // The file offset and starting sample of every FrameIndexInterval-th
+    // frame, built up lazily as getLength and seek scan the file. mScanEnd is
+    // the first frame not yet scanned.
+    struct FramePos { uint64_t mFilePos; uint64_t mSamplePos; };
+    mutable Vector<FramePos> mFrameIndex;
+    mutable FramePos mScanEnd;
+    mutable uint64_t mScanFrames{0};
+    mutable bool mScanDone{false};
+
+    bool isSameFormat(const mp3dec_frame_info_t &frame_info) const
+    {
+        return !((mChannels == ChannelConfig::Mono   && frame_info.channels != 1) ||
+                 (mChannels == ChannelConfig::Stereo && frame_info.channels != 2) ||
+                 mSampleRate != frame_info.hz);
+    }
+    bool scanFrames(uint64_t target) const;
+    bool seekFrame(uint64_t pos);
+    ALuint readFrames(ALvoid *ptr, ALuint count);
+
 public:
-    Mp3Decoder(UniquePtr<std::istream> file, Vector<uint8_t>&& initial_data,
-               const mp3dec_t &mp3, const mp3dec_frame_info_t &first_frame,
-               ChannelConfig chans, SampleType stype, int srate) noexcept
-      : mFile(std::move(file)), mFileData(std::move(initial_data)), mMp3(mp3)
+    Mp3Decoder(UniquePtr<std::istream> file, UniquePtr<ByteSource> source,
+               Mp3FileData&& initial_data, const mp3dec_t &mp3,
+               const mp3dec_frame_info_t &first_frame, ChannelConfig chans, SampleType stype,
+               int srate, uint64_t data_start, const Mp3StreamInfo &info) noexcept
+      : mFile(std::move(file)), mSource(std::move(source)), mFileData(std::move(initial_data))
+      , mMp3(mp3)
       , mLastFrame(first_frame), mChannels(chans), mSampleType(stype), mSampleRate(srate)
-    { }
+      , mScanEnd{data_start, 0}
+    {
+        if(info.mHasFrames)
+        {
+            uint64_t length = info.mFrames * info.mFrameSamples;
+            if(info.mHasGapless)
+            {
+                // The LAME delay doesn't include the decoder's own delay.
+                mStartTrim = std::min<uint64_t>(length, info.mDelay + DecoderDelay);
+                uint64_t padding = std::max(info.mPadding, DecoderDelay) - DecoderDelay;
+                length = std::max(length-mStartTrim, padding) - padding;
+                mEndPos = mStartTrim + length;
+            }
+            mSampleCount = length;
+        }
+    }
     ~Mp3Decoder() override { }
 
     ALuint getFrequency() const noexcept override;
@@ -106,150 +286,162 @@ ALuint Mp3Decoder::getFrequency() const noexcept { return mSampleRate; }
 ChannelConfig Mp3Decoder::getChannelConfig() const noexcept { return mChannels; }
 SampleType Mp3Decoder::getSampleType() const noexcept { return mSampleType; }
 
-uint64_t Mp3Decoder::getLength() const noexcept
+// Scans frame headers from where the last scan ended, indexing them, until
+// passing the frame with the target sample or the end of the file. The file
+// is left at an unspecified position. Must be called with the mutex held.
+bool Mp3Decoder::scanFrames(uint64_t target) const
 {
-    if(LIKELY(mSampleCount >= 0))
-        return mSampleCount;
-
-    std::lock_guard<std::mutex> _(mMutex);
+    if(mScanDone)
+        return true;
 
-    mFile->clear();
-    std::streamsize oldfpos = mFile->tellg();
-    if(oldfpos < 0 || !mFile->seekg(0))
-    {
-        mSampleCount = 0;
-        return mSampleCount;
-    }
+    if(!mSource->seek(mScanEnd.mFilePos))
+        return false;
 
-    Vector<uint8_t> file_data;
+    Mp3FileData file_data;
     mp3dec_t mp3;
-
     mp3dec_init(&mp3);
 
-    append_file_data(*mFile, file_data, MinMp3DataSize);
-
-    size_t id_size = find_i3dv2(file_data);
-    if(id_size > 0)
+    while(mScanEnd.mSamplePos <= target)
     {
-        if(id_size <= file_data.size())
-            file_data.erase(file_data.begin(), file_data.begin()+id_size);
-        else
+        if(mScanFrames%FrameIndexInterval == 0)
+            mFrameIndex.push_back(mScanEnd);
+
+        mp3dec_frame_info_t frame_info{};
+        int samples_to_get = decode_frame(*mSource, mp3, file_data, nullptr, &frame_info);
+        // Stop at the end, or if the frame changed format.
+        if(samples_to_get <= 0 || !isSameFormat(frame_info))
         {
-            mFile->ignore(id_size - file_data.size());
-            file_data.clear();
+            mScanDone = true;
+            break;
         }
+
+        skip_file_data(*mSource, file_data, frame_info.frame_bytes);
+        mScanEnd.mFilePos += frame_info.frame_bytes;
+        mScanEnd.mSamplePos += samples_to_get;
+        ++mScanFrames;
     }
+    return true;
+}
 
-    std::streamsize count = 0;
-    do {
-        // Read the next frame.
-        mp3dec_frame_info_t frame_info{};
-        int samples_to_get = decode_frame(*mFile, mp3, file_data, nullptr, &frame_info);
-        if(samples_to_get <= 0) break;
+uint64_t Mp3Decoder::getLength() const noexcept
+{
+    if(LIKELY(mSampleCount >= 0))
+        return mSampleCount;
 
-        // Don't continue if the frame changed format
-        if((mChannels == ChannelConfig::Mono   && frame_info.channels != 1) ||
-           (mChannels == ChannelConfig::Stereo && frame_info.channels != 2) ||
-           mSampleRate != frame_info.hz)
-            break;
+    std::lock_guard<std::mutex> _(mMutex);
 
-        // Keep going to the next frame
-        if(file_data.size() >= (size_t)frame_info.frame_bytes)
-            file_data.erase(file_data.begin(), file_data.begin()+frame_info.frame_bytes);
-        else
-        {
-            mFile->ignore(frame_info.frame_bytes - file_data.size());
-            file_data.clear();
-        }
-        count += samples_to_get;
-    } while(1);
-    mSampleCount = count;
+    // Without a header giving the length, the whole file needs to be scanned.
+    uint64_t oldfpos = mSource->tell();
+    if(!scanFrames(std::numeric_limits<uint64_t>::max()))
+    {
+        mSampleCount = 0;
+        return mSampleCount;
+    }
+    mSampleCount = mScanEnd.mSamplePos;
 
-    mFile->clear();
-    mFile->seekg(oldfpos);
+    mSource->seek(oldfpos);
     return mSampleCount;
 }
 
 bool Mp3Decoder::seek(uint64_t pos) noexcept
 {
-    // Use temporary local storage to avoid trashing current data in case of
-    // failure.
-    Vector<uint8_t> file_data;
-    mp3dec_t mp3;
-
-    mp3dec_init(&mp3);
-
-    // Seeking to somewhere in the file. Backup the current file position and
-    // reset back to the beginning.
-    // TODO: Obvious optimization: Track the current sample offset and don't
-    // rewind if seeking forward.
-    mFile->clear();
-    std::streamsize oldfpos = mFile->tellg();
-    if(oldfpos < 0 || !mFile->seekg(0))
+    std::lock_guard<std::mutex> _(mMutex);
+    if(pos > mEndPos - mStartTrim || !seekFrame(pos + mStartTrim))
         return false;
+    mCurPos = pos + mStartTrim;
+    return true;
+}
 
-    append_file_data(*mFile, file_data, MinMp3DataSize);
+bool Mp3Decoder::seekFrame(uint64_t pos)
+{
+    uint64_t oldfpos = mSource->tell();
 
-    size_t id_size = find_i3dv2(file_data);
-    if(id_size > 0)
+    // Make sure the index reaches the target, then start from two entries
+    // before it so there's enough prior data to fill the bit reservoir.
+    if(!scanFrames(pos) || mFrameIndex.empty())
     {
-        if(id_size <= file_data.size())
-            file_data.erase(file_data.begin(), file_data.begin()+id_size);
-        else
-        {
-            mFile->ignore(id_size - file_data.size());
-            file_data.clear();
-        }
+        mSource->seek(oldfpos);
+        return false;
     }
+    auto iter = std::upper_bound(mFrameIndex.begin(), mFrameIndex.end(), pos,
+        [](uint64_t lhs, const FramePos &rhs) -> bool { return lhs < rhs.mSamplePos; }
+    );
+    iter -= std::min<ptrdiff_t>(std::distance(mFrameIndex.begin(), iter), 2);
+    FramePos start = *iter;
+
+    // Scan the headers to the frame with the target sample, tracking the
+    // frames before it.
+    Mp3FileData file_data;
+    mp3dec_t mp3;
+    mp3dec_init(&mp3);
 
-    uint64_t curpos = 0;
-    do {
-        // Read the next frame.
+    std::deque<std::pair<FramePos,int>> history;
+    FramePos cur = start;
+    if(mSource->seek(cur.mFilePos)) do {
         mp3dec_frame_info_t frame_info{};
-        int samples_to_get = decode_frame(*mFile, mp3, file_data, nullptr, &frame_info);
-        if(samples_to_get <= 0) break;
-
-        // Don't continue if the frame changed format
-        if((mChannels == ChannelConfig::Mono   && frame_info.channels != 1) ||
-           (mChannels == ChannelConfig::Stereo && frame_info.channels != 2) ||
-           mSampleRate != frame_info.hz)
+        int samples_to_get = decode_frame(*mSource, mp3, file_data, nullptr, &frame_info);
+        if(samples_to_get <= 0 || !isSameFormat(frame_info))
             break;
 
-        if((uint64_t)samples_to_get > pos - curpos)
+        if(static_cast<uint64_t>(samples_to_get) > pos - cur.mSamplePos)
         {
-            // Desired sample is within this frame, decode the samples and go
-            // to the desired offset.
-            Vector<float> sample_data(MINIMP3_MAX_SAMPLES_PER_FRAME);
-            samples_to_get = decode_frame(*mFile, mp3, file_data, sample_data.data(), &frame_info);
-
-            if((uint64_t)samples_to_get > pos - curpos)
+            // Back up over enough of the previous frames to cover the bit
+            // reservoir, and decode them to warm up the decoder.
+            FramePos warm = cur;
+            size_t warmbytes = 0;
+            size_t warmframes = 0;
+            while(!history.empty() && warmbytes <= MaxReservoirBytes)
             {
-                sample_data.resize(samples_to_get * frame_info.channels);
-                sample_data.erase(sample_data.begin(),
-                                  sample_data.begin() + (pos-curpos)*frame_info.channels);
-                file_data.erase(file_data.begin(), file_data.begin()+frame_info.frame_bytes);
-                mSampleData = std::move(sample_data);
-                mFileData = std::move(file_data);
-                mLastFrame = frame_info;
-                mMp3 = mp3;
-                return true;
+                warm = history.back().first;
+                warmbytes += history.back().second;
+                ++warmframes;
+                history.pop_back();
             }
-        }
 
-        // Keep going to the next frame
-        if(file_data.size() >= (size_t)frame_info.frame_bytes)
-            file_data.erase(file_data.begin(), file_data.begin()+frame_info.frame_bytes);
-        else
-        {
-            mFile->ignore(frame_info.frame_bytes - file_data.size());
             file_data.clear();
+            mp3dec_init(&mp3);
+            if(!mSource->seek(warm.mFilePos))
+                break;
+
+            Vector<float> sample_data(MINIMP3_MAX_SAMPLES_PER_FRAME);
+            for(;warmframes > 0;--warmframes)
+            {
+                // Call the decoder directly, since a frame without enough
+                // reservoir data yet decodes to nothing.
+                if(file_data.size() < MinMp3DataSize)
+                    append_file_data(*mSource, file_data, MinMp3DataSize);
+                mp3dec_decode_frame(&mp3, file_data.data(), file_data.size(), sample_data.data(),
+                                    &frame_info);
+                if(frame_info.frame_bytes <= 0)
+                    break;
+                skip_file_data(*mSource, file_data, frame_info.frame_bytes);
+            }
+            if(warmframes > 0)
+                break;
+
+            samples_to_get = decode_frame(*mSource, mp3, file_data, sample_data.data(),
+                                          &frame_info);
+            if(static_cast<uint64_t>(samples_to_get) <= pos - cur.mSamplePos)
+                break;
+
+            sample_data.resize(samples_to_get * frame_info.channels);
+            skip_file_data(*mSource, file_data, frame_info.frame_bytes);
+            mSampleData = std::move(sample_data);
+            mSampleOffset = (pos-cur.mSamplePos) * frame_info.channels;
+            mFileData = std::move(file_data);
+            mLastFrame = frame_info;
+            mMp3 = mp3;
+            return true;
         }
-        curpos += samples_to_get;
+
+        history.emplace_back(cur, frame_info.frame_bytes);
+        skip_file_data(*mSource, file_data, frame_info.frame_bytes);
+        cur.mFilePos += frame_info.frame_bytes;
+        cur.mSamplePos += samples_to_get;
     } while(1);
 
     // Seeking failed. Restore original file position.
-    mFile->clear();
-    mFile->seekg(oldfpos);
+    mSource->seek(oldfpos);
     return false;
 }
 
@@ -259,6 +451,34 @@ std::pair<uint64_t,uint64_t> Mp3Decoder::getLoopPoints() const noexcept
 }
 
 ALuint Mp3Decoder::read(ALvoid *ptr, ALuint count) noexcept
+{
+    std::lock_guard<std::mutex> _(mMutex);
+
+    // Drop the encoder delay at the start.
+    if(mCurPos < mStartTrim)
+    {
+        const ALuint frame_size = mLastFrame.channels *
+            (mSampleType == SampleType::Float32 ? sizeof(float) : sizeof(short));
+        Vector<uint8_t> discard(MINIMP3_MAX_SAMPLES_PER_FRAME/2 * frame_size);
+        while(mCurPos < mStartTrim)
+        {
+            ALuint todo = static_cast<ALuint>(std::min<uint64_t>(
+                mStartTrim-mCurPos, MINIMP3_MAX_SAMPLES_PER_FRAME/2
+            ));
+            ALuint got = readFrames(discard.data(), todo);
+            mCurPos += got;
+            if(got < todo) return 0;
+        }
+    }
+
+    // And the padding at the end.
+    count = static_cast<ALuint>(std::min<uint64_t>(count, mEndPos - mCurPos));
+    ALuint total = readFrames(ptr, count);
+    mCurPos += total;
+    return total;
+}
+
+ALuint Mp3Decoder::readFrames(ALvoid *ptr, ALuint count)
 {
     union {
         void *v;
@@ -267,28 +487,33 @@ ALuint Mp3Decoder::read(ALvoid *ptr, ALuint count) noexcept
     } dst = { ptr };
     ALuint total = 0;
 
-    std::lock_guard<std::mutex> _(mMutex);
     while(total < count)
     {
         ALuint todo = count-total;
 
-        if(!mSampleData.empty())
+        if(mSampleOffset < mSampleData.size())
         {
             // Write out whatever samples we have.
-            todo = std::min<ALuint>(todo, mSampleData.size()/mLastFrame.channels);
+            todo = std::min<ALuint>(todo, (mSampleData.size()-mSampleOffset)/mLastFrame.channels);
 
             size_t numspl = todo*mLastFrame.channels;
+            const float *src = mSampleData.data() + mSampleOffset;
             if(mSampleType == SampleType::Float32)
             {
-                std::copy(mSampleData.begin(), mSampleData.begin()+numspl, dst.f);
+                std::copy(src, src+numspl, dst.f);
                 dst.f += numspl;
             }
             else
             {
-                mp3dec_f32_to_s16(mSampleData.data(), dst.s, numspl);
+                ConvertF32ToS16(dst.s, src, numspl);
                 dst.s += numspl;
             }
-            mSampleData.erase(mSampleData.begin(), mSampleData.begin()+numspl);
+            mSampleOffset += numspl;
+            if(mSampleOffset == mSampleData.size())
+            {
+                mSampleData.clear();
+                mSampleOffset = 0;
+            }
 
             total += todo;
             continue;
@@ -307,7 +532,7 @@ ALuint Mp3Decoder::read(ALvoid *ptr, ALuint count) noexcept
         }
 
         mp3dec_frame_info_t frame_info{};
-        int samples_to_get = decode_frame(*mFile, mMp3, mFileData, samples_ptr, &frame_info);
+        int samples_to_get = decode_frame(*mSource, mMp3, mFileData, samples_ptr, &frame_info);
         if(samples_to_get <= 0)
         {
             mSampleData.clear();
@@ -315,16 +540,14 @@ ALuint Mp3Decoder::read(ALvoid *ptr, ALuint count) noexcept
         }
 
         // Format changing not supported. End the stream.
-        if((mChannels == ChannelConfig::Mono   && frame_info.channels != 1) ||
-           (mChannels == ChannelConfig::Stereo && frame_info.channels != 2) ||
-           mSampleRate != frame_info.hz)
+        if(!isSameFormat(frame_info))
         {
             mSampleData.clear();
             break;
         }
 
         // Remove used file data, update sample storage size with what we got
-        mFileData.erase(mFileData.begin(), mFileData.begin()+frame_info.frame_bytes);
+        mFileData.consume(frame_info.frame_bytes);
         mLastFrame = frame_info;
         if(!mSampleData.empty())
             mSampleData.resize(samples_to_get * frame_info.channels);
@@ -347,35 +570,57 @@ Mp3DecoderFactory::~Mp3DecoderFactory()
 {
 }
 
+SignatureMatch Mp3DecoderFactory::checkSignature(ArrayView<ALbyte> header) const noexcept
+{
+    // Only a frame header at the very start is a sure sign. The decoder also
+    // skips ID3 tags and other data before the first frame, which other
+    // formats may start with too.
+    if(header.size() >= HDR_SIZE && hdr_valid(reinterpret_cast<const uint8_t*>(header.data())))
+        return SignatureMatch::Match;
+    return SignatureMatch::Unknown;
+}
+
 SharedPtr<Decoder> Mp3DecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
-    Vector<uint8_t> initial_data;
+    auto source = MakeByteSource(*file);
+    Mp3FileData initial_data;
     mp3dec_t mp3{};
 
     mp3dec_init(&mp3);
 
     // Make sure the file is valid and we get some samples.
-    if(append_file_data(*file, initial_data, MinMp3DataSize) == 0)
+    if(append_file_data(*source, initial_data, MinMp3DataSize) == 0)
         return nullptr;
 
     // If the file contains an ID3v2 tag, skip it.
     // TODO: Read it? Does it have e.g. sample length or loop points?
     size_t id_size = find_i3dv2(initial_data);
     if(id_size > 0)
-    {
-        if(id_size <= initial_data.size())
-            initial_data.erase(initial_data.begin(), initial_data.begin()+id_size);
-        else
-        {
-            file->ignore(id_size - initial_data.size());
-            initial_data.clear();
-        }
-    }
+        skip_file_data(*source, initial_data, id_size);
 
     mp3dec_frame_info_t frame_info{};
-    int samples_to_get = decode_frame(*file, mp3, initial_data, nullptr, &frame_info);
+    int samples_to_get = decode_frame(*source, mp3, initial_data, nullptr, &frame_info);
     if(!samples_to_get) return nullptr;
 
+    // Skip any junk before the first frame, and check it for an info header
+    // giving the length and gapless trimming. Such a frame doesn't play.
+    size_t frame_start = 0;
+    while(frame_start+1 < initial_data.size() && frame_start < (size_t)frame_info.frame_bytes &&
+          !(initial_data[frame_start] == 0xff && (initial_data[frame_start+1]&0xe0) == 0xe0))
+        ++frame_start;
+    uint64_t data_start = id_size;
+    Mp3StreamInfo info;
+    if(parse_info_frame(initial_data.data()+frame_start, initial_data.size()-frame_start, info))
+    {
+        skip_file_data(*source, initial_data, frame_info.frame_bytes);
+        data_start += frame_info.frame_bytes;
+    }
+    else if(frame_start > 0)
+    {
+        skip_file_data(*source, initial_data, frame_start);
+        data_start += frame_start;
+    }
+
     if(frame_info.hz < 1)
         return nullptr;
 
@@ -391,8 +636,8 @@ SharedPtr<Decoder> Mp3DecoderFactory::createDecoder(UniquePtr<std::istream> &fil
     if(ContextImpl::GetCurrent()->isSupported(chans, SampleType::Float32))
         stype = SampleType::Float32;
 
-    return MakeShared<Mp3Decoder>(std::move(file), std::move(initial_data), mp3,
-                                  frame_info, chans, stype, frame_info.hz);
+    return MakeShared<Mp3Decoder>(std::move(file), std::move(source), std::move(initial_data),
+                                  mp3, frame_info, chans, stype, frame_info.hz, data_start, info);
 }
 
 } // namespace alure
@@ -11,6 +11,7 @@ public:
     ~Mp3DecoderFactory() override;
 
     SharedPtr<Decoder> createDecoder(UniquePtr<std::istream> &file) noexcept override;
+    SignatureMatch checkSignature(ArrayView<ALbyte> header) const noexcept override;
 };
 
 } // namespace alure
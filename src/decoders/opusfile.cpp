@@ -4,47 +4,40 @@
 #include <stdexcept>
 #include <iostream>
 #include <limits>
+#include <cstring>
 
 #include "buffer.h"
+#include "sampleconv.h"
+#include "bytesource.h"
 
 #include "opusfile.h"
 
 namespace {
 
-int istream_read(void *user_data, unsigned char *ptr, int size)
+int source_read(void *user_data, unsigned char *ptr, int size)
 {
-    std::istream *stream = static_cast<std::istream*>(user_data);
-    stream->clear();
-
-    if(size < 0 || !stream->read(reinterpret_cast<char*>(ptr), size))
-        return -1;
-    return stream->gcount();
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    if(size < 0) return -1;
+    return static_cast<int>(source->read(ptr, size));
 }
 
-int istream_seek(void *user_data, opus_int64 offset, int whence)
+int source_seek(void *user_data, opus_int64 offset, int whence)
 {
-    std::istream *stream = static_cast<std::istream*>(user_data);
-    stream->clear();
-
-    if(whence == SEEK_CUR)
-        stream->seekg(offset, std::ios_base::cur);
-    else if(whence == SEEK_SET)
-        stream->seekg(offset, std::ios_base::beg);
-    else if(whence == SEEK_END)
-        stream->seekg(offset, std::ios_base::end);
-    else
-        return -1;
-
-    return stream->good() ? 0 : -1;
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    return source->seek(offset, whence) ? 0 : -1;
 }
 
-opus_int64 istream_tell(void *user_data)
+opus_int64 source_tell(void *user_data)
 {
-    std::istream *stream = static_cast<std::istream*>(user_data);
-    stream->clear();
-    return stream->tellg();
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    uint64_t pos = source->tell();
+    return (pos == alure::ByteSource::InvalidPos) ? -1 : static_cast<opus_int64>(pos);
 }
 
+const OpusFileCallbacks SourceCallbacks = {
+    source_read, source_seek, source_tell, nullptr
+};
+
 
 template<typename T> struct OggTypeInfo { };
 template<>
@@ -71,7 +64,8 @@ using OggOpusFilePtr = alure::UniquePtr<OggOpusFile,OggOpusFileDeleter>;
 namespace alure {
 
 class OpusFileDecoder final : public Decoder {
-    UniquePtr<std::istream> mFile;
+    SharedPtr<std::istream> mFile;
+    UniquePtr<ByteSource> mSource;
 
     OggOpusFilePtr mOggFile;
     int mOggBitstream{0};
@@ -100,56 +94,17 @@ class OpusFileDecoder final : public Decoder {
             total += got;
         }
 
-        // 1, 2, and 4 channel files decode into the same channel order as
-        // OpenAL, however 6 (5.1), 7 (6.1), and 8 (7.1) channel files need to be
-        // re-ordered.
-        if(mChannelConfig == ChannelConfig::X51)
-        {
-            samples = ptr;
-            for(ALuint i = 0;i < total;++i)
-            {
-                // OpenAL : FL, FR, FC, LFE, RL, RR
-                // Opus   : FL, FC, FR,  RL, RR, LFE
-                std::swap(samples[i*6 + 1], samples[i*6 + 2]);
-                std::swap(samples[i*6 + 3], samples[i*6 + 5]);
-                std::swap(samples[i*6 + 4], samples[i*6 + 5]);
-            }
-        }
-        else if(mChannelConfig == ChannelConfig::X61)
-        {
-            samples = ptr;
-            for(ALuint i = 0;i < total;++i)
-            {
-                // OpenAL : FL, FR, FC, LFE, RC, SL, SR
-                // Opus   : FL, FC, FR,  SL, SR, RC, LFE
-                std::swap(samples[i*7 + 1], samples[i*7 + 2]);
-                std::swap(samples[i*7 + 3], samples[i*7 + 6]);
-                std::swap(samples[i*7 + 4], samples[i*7 + 5]);
-                std::swap(samples[i*7 + 5], samples[i*7 + 6]);
-            }
-        }
-        else if(mChannelConfig == ChannelConfig::X71)
-        {
-            samples = ptr;
-            for(ALuint i = 0;i < total;++i)
-            {
-                // OpenAL : FL, FR, FC, LFE, RL, RR, SL, SR
-                // Opus   : FL, FC, FR,  SL, SR, RL, RR, LFE
-                std::swap(samples[i*8 + 1], samples[i*8 + 2]);
-                std::swap(samples[i*8 + 3], samples[i*8 + 7]);
-                std::swap(samples[i*8 + 4], samples[i*8 + 5]);
-                std::swap(samples[i*8 + 5], samples[i*8 + 6]);
-                std::swap(samples[i*8 + 6], samples[i*8 + 7]);
-            }
-        }
+        ReorderVorbisChannels(ptr, total, mChannelConfig);
 
         return total;
     }
 
 public:
-    OpusFileDecoder(UniquePtr<std::istream> file, OggOpusFilePtr oggfile, ChannelConfig sconfig,
+    OpusFileDecoder(SharedPtr<std::istream> file, UniquePtr<ByteSource> source,
+                    OggOpusFilePtr oggfile, ChannelConfig sconfig,
                     SampleType stype, const std::pair<uint64_t,uint64_t> &loop_points) noexcept
-      : mFile(std::move(file)), mOggFile(std::move(oggfile)), mChannelConfig(sconfig)
+      : mFile(std::move(file)), mSource(std::move(source)), mOggFile(std::move(oggfile))
+      , mChannelConfig(sconfig)
       , mSampleType(stype), mLoopPts(loop_points)
     { }
     ~OpusFileDecoder() override { }
@@ -164,6 +119,8 @@ public:
     std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override;
 
     ALuint read(ALvoid *ptr, ALuint count) noexcept override;
+
+    SharedPtr<Decoder> cloneAt(uint64_t pos) const noexcept override;
 };
 
 // libopusfile always decodes to 48khz.
@@ -194,14 +151,29 @@ ALuint OpusFileDecoder::read(ALvoid *ptr, ALuint count) noexcept
     return do_read(reinterpret_cast<ogg_int16_t*>(ptr), count);
 }
 
+SharedPtr<Decoder> OpusFileDecoder::cloneAt(uint64_t pos) const noexcept
+{
+    ArrayView<ALbyte> view = mSource->getView();
+    if(view.empty()) return nullptr;
+
+    auto source = MakeByteSource(view);
+    OggOpusFilePtr oggfile(op_open_callbacks(source.get(), &SourceCallbacks, nullptr, 0, nullptr));
+    if(!oggfile) return nullptr;
+
+    auto decoder = MakeShared<OpusFileDecoder>(mFile, std::move(source), std::move(oggfile),
+                                               mChannelConfig, mSampleType, mLoopPts);
+    if(!decoder->seek(pos)) return nullptr;
+    return decoder;
+}
+
+
+SignatureMatch OpusFileDecoderFactory::checkSignature(ArrayView<ALbyte> header) const noexcept
+{ return CheckOggSignature(header, "OpusHead", 8); }
 
 SharedPtr<Decoder> OpusFileDecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
-    static const OpusFileCallbacks streamIO = {
-        istream_read, istream_seek, istream_tell, nullptr
-    };
-
-    OggOpusFilePtr oggfile(op_open_callbacks(file.get(), &streamIO, nullptr, 0, nullptr));
+    auto source = MakeByteSource(*file);
+    OggOpusFilePtr oggfile(op_open_callbacks(source.get(), &SourceCallbacks, nullptr, 0, nullptr));
     if(!oggfile) return nullptr;
 
     std::pair<uint64_t,uint64_t> loop_points = { 0, std::numeric_limits<uint64_t>::max() };
@@ -261,10 +233,10 @@ SharedPtr<Decoder> OpusFileDecoderFactory::createDecoder(UniquePtr<std::istream>
         return nullptr;
 
     if(Context::GetCurrent().isSupported(channels, SampleType::Float32))
-        return MakeShared<OpusFileDecoder>(std::move(file), std::move(oggfile), channels,
-                                           SampleType::Float32, loop_points);
-    return MakeShared<OpusFileDecoder>(std::move(file), std::move(oggfile), channels,
-                                       SampleType::Int16, loop_points);
+        return MakeShared<OpusFileDecoder>(std::move(file), std::move(source), std::move(oggfile),
+                                           channels, SampleType::Float32, loop_points);
+    return MakeShared<OpusFileDecoder>(std::move(file), std::move(source), std::move(oggfile),
+                                       channels, SampleType::Int16, loop_points);
 }
 
 } // namespace alure
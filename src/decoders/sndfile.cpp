@@ -1,5 +1,6 @@
 
 #include "sndfile.hpp"
+#include "bytesource.h"
 
 #include <stdexcept>
 #include <iostream>
@@ -20,53 +21,48 @@ constexpr alure::Array<int,3> CHANNELS_BFORMAT2D {{SF_CHANNEL_MAP_AMBISONIC_B_W,
 constexpr alure::Array<int,4> CHANNELS_BFORMAT3D {{SF_CHANNEL_MAP_AMBISONIC_B_W, SF_CHANNEL_MAP_AMBISONIC_B_X, SF_CHANNEL_MAP_AMBISONIC_B_Y, SF_CHANNEL_MAP_AMBISONIC_B_Z}};
 
 
-sf_count_t istream_get_filelen(void *user_data)
+sf_count_t source_get_filelen(void *user_data)
 {
-    std::istream *file = reinterpret_cast<std::istream*>(user_data);
-    file->clear();
-
-    sf_count_t len = -1;
-    std::streampos pos = file->tellg();
-    if(pos != static_cast<std::streampos>(-1) && file->seekg(0, std::ios::end))
-    {
-        len = file->tellg();
-        file->seekg(pos);
-    }
-    return len;
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    uint64_t size = source->size();
+    if(size == alure::ByteSource::UnknownSize)
+        return -1;
+    return static_cast<sf_count_t>(size);
 }
 
-sf_count_t istream_seek(sf_count_t offset, int whence, void *user_data)
+sf_count_t source_seek(sf_count_t offset, int whence, void *user_data)
 {
-    std::istream *file = reinterpret_cast<std::istream*>(user_data);
-    file->clear();
-
-    if(!file->seekg(offset, std::ios::seekdir(whence)))
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    if(!source->seek(static_cast<int64_t>(offset), whence))
         return -1;
-    return file->tellg();
+    uint64_t pos = source->tell();
+    return (pos == alure::ByteSource::InvalidPos) ? -1 : static_cast<sf_count_t>(pos);
 }
 
-sf_count_t istream_read(void *ptr, sf_count_t count, void *user_data)
+sf_count_t source_read(void *ptr, sf_count_t count, void *user_data)
 {
-    std::istream *file = reinterpret_cast<std::istream*>(user_data);
-    file->clear();
-
-    file->read(reinterpret_cast<char*>(ptr), count);
-    return file->gcount();
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    if(count <= 0) return 0;
+    return static_cast<sf_count_t>(source->read(ptr, static_cast<size_t>(count)));
 }
 
-sf_count_t istream_write(const void*, sf_count_t, void*)
+sf_count_t source_write(const void*, sf_count_t, void*)
 {
     return -1;
 }
 
-sf_count_t istream_tell(void *user_data)
+sf_count_t source_tell(void *user_data)
 {
-    std::istream *file = reinterpret_cast<std::istream*>(user_data);
-    file->clear();
-
-    return file->tellg();
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    uint64_t pos = source->tell();
+    return (pos == alure::ByteSource::InvalidPos) ? -1 : static_cast<sf_count_t>(pos);
 }
 
+SF_VIRTUAL_IO SourceCallbacks = {
+    source_get_filelen, source_seek,
+    source_read, source_write, source_tell
+};
+
 
 struct SndfileDeleter {
     void operator()(SNDFILE *ptr) const { sf_close(ptr); }
@@ -78,7 +74,8 @@ using SndfilePtr = alure::UniquePtr<SNDFILE,SndfileDeleter>;
 namespace alure {
 
 class SndFileDecoder final : public Decoder {
-    UniquePtr<std::istream> mFile;
+    SharedPtr<std::istream> mFile;
+    UniquePtr<ByteSource> mSource;
 
     SndfilePtr mSndFile;
     SF_INFO mSndInfo;
@@ -88,10 +85,12 @@ class SndFileDecoder final : public Decoder {
     std::pair<uint64_t, uint64_t> mLoopPts{0, 0};
 
 public:
-    SndFileDecoder(UniquePtr<std::istream> file, SndfilePtr sndfile, const SF_INFO &sndinfo,
-                   ChannelConfig sconfig, SampleType stype, uint64_t loopstart, uint64_t loopend) noexcept
-      : mFile(std::move(file)), mSndFile(std::move(sndfile)), mSndInfo(sndinfo)
-      , mChannelConfig(sconfig), mSampleType(stype), mLoopPts{loopstart, loopend}
+    SndFileDecoder(SharedPtr<std::istream> file, UniquePtr<ByteSource> source, SndfilePtr sndfile,
+                   const SF_INFO &sndinfo, ChannelConfig sconfig, SampleType stype,
+                   uint64_t loopstart, uint64_t loopend) noexcept
+      : mFile(std::move(file)), mSource(std::move(source)), mSndFile(std::move(sndfile))
+      , mSndInfo(sndinfo), mChannelConfig(sconfig), mSampleType(stype)
+      , mLoopPts{loopstart, loopend}
     { }
     ~SndFileDecoder() override { }
 
@@ -105,6 +104,8 @@ public:
     std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override;
 
     ALuint read(ALvoid *ptr, ALuint count) noexcept override;
+
+    SharedPtr<Decoder> cloneAt(uint64_t pos) const noexcept override;
 };
 
 ALuint SndFileDecoder::getFrequency() const noexcept { return mSndInfo.samplerate; }
@@ -146,15 +147,28 @@ ALuint SndFileDecoder::read(ALvoid *ptr, ALuint count) noexcept
     return (ALuint)std::max<sf_count_t>(got, 0);
 }
 
+SharedPtr<Decoder> SndFileDecoder::cloneAt(uint64_t pos) const noexcept
+{
+    ArrayView<ALbyte> view = mSource->getView();
+    if(view.empty()) return nullptr;
+
+    auto source = MakeByteSource(view);
+    SF_INFO sndinfo;
+    SndfilePtr sndfile(sf_open_virtual(&SourceCallbacks, SFM_READ, &sndinfo, source.get()));
+    if(!sndfile || sndinfo.channels != mSndInfo.channels) return nullptr;
+
+    auto decoder = MakeShared<SndFileDecoder>(mFile, std::move(source), std::move(sndfile),
+        sndinfo, mChannelConfig, mSampleType, mLoopPts.first, mLoopPts.second);
+    if(!decoder->seek(pos)) return nullptr;
+    return decoder;
+}
+
 
 SharedPtr<Decoder> SndFileDecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
-    SF_VIRTUAL_IO vio = {
-        istream_get_filelen, istream_seek,
-        istream_read, istream_write, istream_tell
-    };
+    auto source = MakeByteSource(*file);
     SF_INFO sndinfo;
-    SndfilePtr sndfile(sf_open_virtual(&vio, SFM_READ, &sndinfo, file.get()));
+    SndfilePtr sndfile(sf_open_virtual(&SourceCallbacks, SFM_READ, &sndinfo, source.get()));
     if(!sndfile) return nullptr;
 
     std::pair<uint64_t, uint64_t> cue_points{0, std::numeric_limits<uint64_t>::max()};
@@ -256,8 +270,8 @@ SharedPtr<Decoder> SndFileDecoderFactory::createDecoder(UniquePtr<std::istream>
             break;
     }
 
-    return MakeShared<SndFileDecoder>(std::move(file), std::move(sndfile), sndinfo, sconfig, stype,
-        cue_points.first, cue_points.second);
+    return MakeShared<SndFileDecoder>(std::move(file), std::move(source), std::move(sndfile),
+        sndinfo, sconfig, stype, cue_points.first, cue_points.second);
 }
 
 } // namespace alure
@@ -2,48 +2,38 @@
 #include "vorbisfile.hpp"
 
 #include <iostream>
+#include <cstring>
 
 #include "context.h"
+#include "sampleconv.h"
+#include "bytesource.h"
 
 #include "vorbis/vorbisfile.h"
 
 namespace {
 
-int istream_seek(void *user_data, ogg_int64_t offset, int whence)
+int source_seek(void *user_data, ogg_int64_t offset, int whence)
 {
-    std::istream *stream = static_cast<std::istream*>(user_data);
-    stream->clear();
-
-    if(whence == SEEK_CUR)
-        stream->seekg(offset, std::ios_base::cur);
-    else if(whence == SEEK_SET)
-        stream->seekg(offset, std::ios_base::beg);
-    else if(whence == SEEK_END)
-        stream->seekg(offset, std::ios_base::end);
-    else
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    if(!source->seek(offset, whence))
         return -1;
-
-    return stream->tellg();
+    return 0;
 }
 
-size_t istream_read(void *ptr, size_t size, size_t nmemb, void *user_data)
+size_t source_read(void *ptr, size_t size, size_t nmemb, void *user_data)
 {
-    std::istream *stream = static_cast<std::istream*>(user_data);
-    stream->clear();
-
-    stream->read(static_cast<char*>(ptr), nmemb*size);
-    size_t ret = stream->gcount();
-    return ret/size;
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    return source->read(ptr, nmemb*size) / size;
 }
 
-long istream_tell(void *user_data)
+long source_tell(void *user_data)
 {
-    std::istream *stream = static_cast<std::istream*>(user_data);
-    stream->clear();
-    return stream->tellg();
+    alure::ByteSource *source = static_cast<alure::ByteSource*>(user_data);
+    uint64_t pos = source->tell();
+    return (pos == alure::ByteSource::InvalidPos) ? -1 : static_cast<long>(pos);
 }
 
-int istream_close(void*) { return 0; }
+int source_close(void*) { return 0; }
 
 
 struct OggVorbisfileHolder : public OggVorbis_File {
@@ -58,21 +48,27 @@ namespace alure {
 
 class VorbisFileDecoder final : public Decoder {
     UniquePtr<std::istream> mFile;
+    UniquePtr<ByteSource> mSource;
 
     OggVorbisfilePtr mOggFile;
     vorbis_info *mVorbisInfo{nullptr};
     int mOggBitstream{0};
 
     ChannelConfig mChannelConfig{ChannelConfig::Mono};
+    SampleType mSampleType{SampleType::Int16};
 
     std::pair<uint64_t,uint64_t> mLoopPoints{0, 0};
 
+    ALuint readShort(ALshort *ptr, ALuint count) noexcept;
+    ALuint readFloat(ALfloat *ptr, ALuint count) noexcept;
+
 public:
-    VorbisFileDecoder(UniquePtr<std::istream> file, OggVorbisfilePtr oggfile,
-                      vorbis_info *vorbisinfo, ChannelConfig sconfig,
-                      std::pair<uint64_t,uint64_t> loop_points) noexcept
-      : mFile(std::move(file)), mOggFile(std::move(oggfile)), mVorbisInfo(vorbisinfo)
-      , mChannelConfig(sconfig), mLoopPoints(loop_points)
+    VorbisFileDecoder(UniquePtr<std::istream> file, UniquePtr<ByteSource> source,
+                      OggVorbisfilePtr oggfile, vorbis_info *vorbisinfo, ChannelConfig sconfig,
+                      SampleType stype, std::pair<uint64_t,uint64_t> loop_points) noexcept
+      : mFile(std::move(file)), mSource(std::move(source)), mOggFile(std::move(oggfile))
+      , mVorbisInfo(vorbisinfo)
+      , mChannelConfig(sconfig), mSampleType(stype), mLoopPoints(loop_points)
     { }
     ~VorbisFileDecoder() override { }
 
@@ -90,7 +86,7 @@ public:
 
 ALuint VorbisFileDecoder::getFrequency() const noexcept { return mVorbisInfo->rate; }
 ChannelConfig VorbisFileDecoder::getChannelConfig() const noexcept { return mChannelConfig; }
-SampleType VorbisFileDecoder::getSampleType() const noexcept { return SampleType::Int16; }
+SampleType VorbisFileDecoder::getSampleType() const noexcept { return mSampleType; }
 
 uint64_t VorbisFileDecoder::getLength() const noexcept
 {
@@ -109,9 +105,16 @@ std::pair<uint64_t,uint64_t> VorbisFileDecoder::getLoopPoints() const noexcept
 }
 
 ALuint VorbisFileDecoder::read(ALvoid *ptr, ALuint count) noexcept
+{
+    if(mSampleType == SampleType::Float32)
+        return readFloat(static_cast<ALfloat*>(ptr), count);
+    return readShort(static_cast<ALshort*>(ptr), count);
+}
+
+ALuint VorbisFileDecoder::readShort(ALshort *ptr, ALuint count) noexcept
 {
     ALuint total = 0;
-    ALshort *samples = (ALshort*)ptr;
+    ALshort *samples = ptr;
     while(total < count)
     {
         int len = (count-total) * mVorbisInfo->channels * 2;
@@ -128,61 +131,50 @@ ALuint VorbisFileDecoder::read(ALvoid *ptr, ALuint count) noexcept
         total += got;
     }
 
-    // 1, 2, and 4 channel files decode into the same channel order as
-    // OpenAL, however 6 (5.1), 7 (6.1), and 8 (7.1) channel files need to be
-    // re-ordered.
-    if(mChannelConfig == ChannelConfig::X51)
-    {
-        samples = (ALshort*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RL, RR
-            // Vorbis : FL, FC, FR,  RL, RR, LFE
-            std::swap(samples[i*6 + 1], samples[i*6 + 2]);
-            std::swap(samples[i*6 + 3], samples[i*6 + 5]);
-            std::swap(samples[i*6 + 4], samples[i*6 + 5]);
-        }
-    }
-    else if(mChannelConfig == ChannelConfig::X61)
-    {
-        samples = (ALshort*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RC, SL, SR
-            // Vorbis : FL, FC, FR,  SL, SR, RC, LFE
-            std::swap(samples[i*7 + 1], samples[i*7 + 2]);
-            std::swap(samples[i*7 + 3], samples[i*7 + 6]);
-            std::swap(samples[i*7 + 4], samples[i*7 + 5]);
-            std::swap(samples[i*7 + 5], samples[i*7 + 6]);
-        }
-    }
-    else if(mChannelConfig == ChannelConfig::X71)
+    ReorderVorbisChannels(ptr, total, mChannelConfig);
+
+    return total;
+}
+
+ALuint VorbisFileDecoder::readFloat(ALfloat *ptr, ALuint count) noexcept
+{
+    // The decoder's float output is planar, so it gets interleaved and
+    // reordered in one pass.
+    const ALubyte *order = GetVorbisChannelOrder(mChannelConfig);
+    const int num_chans = mVorbisInfo->channels;
+    ALuint total = 0;
+    while(total < count)
     {
-        samples = (ALshort*)ptr;
-        for(ALuint i = 0;i < total;++i)
-        {
-            // OpenAL : FL, FR, FC, LFE, RL, RR, SL, SR
-            // Vorbis : FL, FC, FR,  SL, SR, RL, RR, LFE
-            std::swap(samples[i*8 + 1], samples[i*8 + 2]);
-            std::swap(samples[i*8 + 3], samples[i*8 + 7]);
-            std::swap(samples[i*8 + 4], samples[i*8 + 5]);
-            std::swap(samples[i*8 + 5], samples[i*8 + 6]);
-            std::swap(samples[i*8 + 6], samples[i*8 + 7]);
-        }
+        float **pcm;
+        long got = ov_read_float(mOggFile.get(), &pcm, count-total, &mOggBitstream);
+        if(got <= 0) break;
+
+        // Channel count changes aren't supported. End the stream.
+        vorbis_info *info = ov_info(mOggFile.get(), mOggBitstream);
+        if(!info || info->channels != num_chans)
+            break;
+
+        Interleave(ptr, pcm, num_chans, got, order);
+        ptr += got*num_chans;
+        total += got;
     }
 
     return total;
 }
 
 
+SignatureMatch VorbisFileDecoderFactory::checkSignature(ArrayView<ALbyte> header) const noexcept
+{ return CheckOggSignature(header, "\x01vorbis", 7); }
+
 SharedPtr<Decoder> VorbisFileDecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
     static const ov_callbacks streamIO = {
-        istream_read, istream_seek, istream_close, istream_tell
+        source_read, source_seek, source_close, source_tell
     };
 
+    auto source = MakeByteSource(*file);
     auto oggfile = MakeUnique<OggVorbisfilePtr::element_type>();
-    if(ov_open_callbacks(file.get(), oggfile.get(), NULL, 0, streamIO) != 0)
+    if(ov_open_callbacks(source.get(), oggfile.get(), NULL, 0, streamIO) != 0)
         return nullptr;
 
     vorbis_info *vorbisinfo = ov_info(oggfile.get(), -1);
@@ -243,8 +235,15 @@ SharedPtr<Decoder> VorbisFileDecoderFactory::createDecoder(UniquePtr<std::istrea
     else
         return nullptr;
 
+    // Vorbis decodes to float internally, so use that when possible rather
+    // than have it converted.
+    SampleType stype = SampleType::Int16;
+    if(Context::GetCurrent().isSupported(channels, SampleType::Float32))
+        stype = SampleType::Float32;
+
     return MakeShared<VorbisFileDecoder>(
-        std::move(file), std::move(oggfile), vorbisinfo, channels, loop_points
+        std::move(file), std::move(source), std::move(oggfile), vorbisinfo, channels, stype,
+        loop_points
     );
 }
 
@@ -6,6 +6,8 @@
 #include <cstring>
 
 #include "buffer.h"
+#include "sampleconv.h"
+#include "bytesource.h"
 
 
 namespace {
@@ -53,19 +55,19 @@ constexpr int CHANNELS_6DOT1      = 0x01 | 0x02 | 0x04 | 0x08               | 0x
 constexpr int CHANNELS_7DOT1      = 0x01 | 0x02 | 0x04 | 0x08 | 0x10 | 0x20 | 0x200         | 0x400;
 
 
-ALuint read_le32(std::istream &stream)
+ALuint read_le32(alure::ByteSource &source)
 {
     char buf[4];
-    if(!stream.read(buf, sizeof(buf)) || stream.gcount() != sizeof(buf))
+    if(source.read(buf, sizeof(buf)) != sizeof(buf))
         return 0;
     return ((ALuint(buf[0]    )&0x000000ff) | (ALuint(buf[1]<< 8)&0x0000ff00) |
             (ALuint(buf[2]<<16)&0x00ff0000) | (ALuint(buf[3]<<24)&0xff000000));
 }
 
-ALushort read_le16(std::istream &stream)
+ALushort read_le16(alure::ByteSource &source)
 {
     char buf[2];
-    if(!stream.read(buf, sizeof(buf)) || stream.gcount() != sizeof(buf))
+    if(source.read(buf, sizeof(buf)) != sizeof(buf))
         return 0;
     return ((ALushort(buf[0]   )&0x00ff) | (ALushort(buf[1]<<8)&0xff00));
 }
@@ -75,27 +77,36 @@ ALushort read_le16(std::istream &stream)
 namespace alure {
 
 class WaveDecoder final : public Decoder {
-    UniquePtr<std::istream> mFile;
+    // Clones share the file, each reading its memory through their own
+    // source.
+    SharedPtr<std::istream> mFile;
+    UniquePtr<ByteSource> mSource;
 
     ChannelConfig mChannelConfig{ChannelConfig::Mono};
     SampleType mSampleType{SampleType::UInt8};
+    // The type stored in the file, which is converted to mSampleType if they
+    // differ.
+    SampleType mFileType{SampleType::UInt8};
     ALuint mFrequency{0};
+    // Size of a sample frame in the file
     ALuint mFrameSize{0};
 
     // In sample frames, relative to sample data start
     std::pair<uint64_t,uint64_t> mLoopPts{0, 0};
 
     // In bytes from beginning of file
-    std::istream::pos_type mStart{0}, mEnd{0};
-    std::istream::pos_type mCurrentPos{0};
+    uint64_t mStart{0}, mEnd{0};
+    uint64_t mCurrentPos{0};
 
 public:
-    WaveDecoder(UniquePtr<std::istream> file, ChannelConfig channels, SampleType type,
-                ALuint frequency, ALuint framesize, std::istream::pos_type start,
-                std::istream::pos_type end, uint64_t loopstart, uint64_t loopend) noexcept
-      : mFile(std::move(file)), mChannelConfig(channels), mSampleType(type), mFrequency(frequency)
-      , mFrameSize(framesize), mLoopPts{loopstart,loopend}, mStart(start), mEnd(end)
-    { mCurrentPos = mFile->tellg(); }
+    WaveDecoder(SharedPtr<std::istream> file, UniquePtr<ByteSource> source,
+                ChannelConfig channels, SampleType type, SampleType filetype, ALuint frequency,
+                ALuint framesize, uint64_t start, uint64_t end, uint64_t loopstart,
+                uint64_t loopend) noexcept
+      : mFile(std::move(file)), mSource(std::move(source)), mChannelConfig(channels)
+      , mSampleType(type), mFileType(filetype), mFrequency(frequency), mFrameSize(framesize)
+      , mLoopPts{loopstart,loopend}, mStart(start), mEnd(end)
+    { mCurrentPos = mSource->tell(); }
     ~WaveDecoder() override { }
 
     ALuint getFrequency() const noexcept override;
@@ -108,6 +119,9 @@ public:
     std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override;
 
     ALuint read(ALvoid *ptr, ALuint count) noexcept override;
+
+    ArrayView<ALbyte> getDirectData() noexcept override;
+    SharedPtr<Decoder> cloneAt(uint64_t pos) const noexcept override;
 };
 
 ALuint WaveDecoder::getFrequency() const noexcept { return mFrequency; }
@@ -119,9 +133,8 @@ uint64_t WaveDecoder::getLength() const noexcept
 
 bool WaveDecoder::seek(uint64_t pos) noexcept
 {
-    std::streamsize offset = pos*mFrameSize + mStart;
-    mFile->clear();
-    if(offset > mEnd || !mFile->seekg(offset))
+    uint64_t offset = pos*mFrameSize + mStart;
+    if(offset > mEnd || !mSource->seek(offset))
         return false;
     mCurrentPos = offset;
     return true;
@@ -131,71 +144,106 @@ std::pair<uint64_t,uint64_t> WaveDecoder::getLoopPoints() const noexcept { retur
 
 ALuint WaveDecoder::read(ALvoid *ptr, ALuint count) noexcept
 {
-    mFile->clear();
-
     ALuint total = 0;
-    if(mCurrentPos < mEnd)
+    if(mCurrentPos >= mEnd)
+        return total;
+
+    if(mFileType == mSampleType)
     {
         ALuint len = static_cast<ALuint>(
-            std::min<std::istream::pos_type>(count*mFrameSize, mEnd-mCurrentPos)
+            std::min<uint64_t>(count*mFrameSize, mEnd-mCurrentPos)
         );
-#ifdef __BIG_ENDIAN__
-        switch(mSampleType)
-        {
-            case SampleType::Float32:
-                while(total < len && mFile->good() && !mFile->eof())
-                {
-                    char temp[256];
-                    ALuint todo = std::min<ALuint>(len-total, sizeof(temp));
-
-                    mFile->read(temp, todo);
-                    ALuint got = static_cast<ALuint>(mFile->gcount());
-
-                    for(ALuint i = 0;i < got;++i)
-                        reinterpret_cast<char*>(ptr)[total+i] = temp[i^3];
-
-                    mCurrentPos += got;
-                    total += got;
-                    if(got < todo) break;
-                }
-                total /= mFrameSize;
-                break;
+        ALuint got = static_cast<ALuint>(mSource->read(ptr, len));
 
-            case SampleType::Int16:
-                while(total < len && mFile->good() && !mFile->eof())
-                {
-                    char temp[256];
-                    ALuint todo = std::min<ALuint>(len-total, sizeof(temp));
-
-                    mFile->read(temp, todo);
-                    ALuint got = static_cast<ALuint>(mFile->gcount());
+        mCurrentPos += got;
+        total = got / mFrameSize;
+#ifdef __BIG_ENDIAN__
+        if(mSampleType == SampleType::Float32)
+            ByteSwap32(ptr, total*mFrameSize / 4);
+        else if(mSampleType == SampleType::Int16)
+            ByteSwap16(ptr, total*mFrameSize / 2);
+#endif
+        return total;
+    }
 
-                    for(ALuint i = 0;i < got;++i)
-                        reinterpret_cast<char*>(ptr)[total+i] = temp[i^1];
+    // Otherwise, the file's samples are converted to 16-bit, through a
+    // temporary buffer.
+    ALshort *dst = static_cast<ALshort*>(ptr);
+    const ALuint chans = FramesToBytes(1, mChannelConfig, SampleType::UInt8);
+    while(total < count)
+    {
+        ALfloat temp[1024];
+        ALuint todo = std::min<ALuint>(count-total, sizeof(temp) / mFrameSize);
+        ALuint len = static_cast<ALuint>(
+            std::min<uint64_t>(todo*mFrameSize, mEnd-mCurrentPos)
+        );
+        if(len == 0) break;
 
-                    mCurrentPos += got;
-                    total += got;
-                    if(got < todo) break;
-                }
-                total /= mFrameSize;
-                break;
+        ALuint got = static_cast<ALuint>(mSource->read(temp, len));
+        mCurrentPos += got;
 
-            case SampleType::UInt8:
-            case SampleType::Mulaw:
-#else
+        ALuint frames = got / mFrameSize;
+        size_t numspl = frames * chans;
+        if(mFileType == SampleType::Float32)
         {
+#ifdef __BIG_ENDIAN__
+            ByteSwap32(temp, numspl);
 #endif
-                mFile->read(reinterpret_cast<char*>(ptr), len);
-                ALuint got = static_cast<ALuint>(mFile->gcount());
-
-                mCurrentPos += got;
-                total = got / mFrameSize;
+            ConvertF32ToS16(dst, temp, numspl);
         }
+        else if(mFileType == SampleType::Mulaw)
+            ConvertMulawToS16(dst, reinterpret_cast<ALubyte*>(temp), numspl);
+        else
+            ConvertU8ToS16(dst, reinterpret_cast<ALubyte*>(temp), numspl);
+        dst += numspl;
+        total += frames;
+
+        if(got < len) break;
     }
 
     return total;
 }
 
+ArrayView<ALbyte> WaveDecoder::getDirectData() noexcept
+{
+    // The samples can only be used as they are in the file if they don't
+    // need any conversion.
+    if(mFileType != mSampleType)
+        return {};
+#ifdef __BIG_ENDIAN__
+    if(mSampleType == SampleType::Int16 || mSampleType == SampleType::Float32)
+        return {};
+#endif
+
+    ArrayView<ALbyte> view = mSource->getView();
+    if(view.size() < mEnd)
+        return {};
+    return view.slice(static_cast<size_t>(mStart), static_cast<size_t>(mEnd-mStart));
+}
+
+SharedPtr<Decoder> WaveDecoder::cloneAt(uint64_t pos) const noexcept
+{
+    // Only a file that's in memory can be read by more than one decoder at
+    // once.
+    ArrayView<ALbyte> view = mSource->getView();
+    if(view.empty()) return nullptr;
+
+    auto decoder = MakeShared<WaveDecoder>(mFile, MakeByteSource(view), mChannelConfig,
+        mSampleType, mFileType, mFrequency, mFrameSize, mStart, mEnd, mLoopPts.first,
+        mLoopPts.second
+    );
+    if(!decoder->seek(pos)) return nullptr;
+    return decoder;
+}
+
+
+SignatureMatch WaveDecoderFactory::checkSignature(ArrayView<ALbyte> header) const noexcept
+{
+    if(header.size() >= 12 && memcmp(header.data(), "RIFF", 4) == 0 &&
+       memcmp(header.data()+8, "WAVE", 4) == 0)
+        return SignatureMatch::Match;
+    return SignatureMatch::NoMatch;
+}
 
 SharedPtr<Decoder> WaveDecoderFactory::createDecoder(UniquePtr<std::istream> &file) noexcept
 {
@@ -207,18 +255,19 @@ SharedPtr<Decoder> WaveDecoderFactory::createDecoder(UniquePtr<std::istream> &fi
     ALuint blockalign = 0;
     ALuint framealign = 0;
 
+    auto source = MakeByteSource(*file);
     char tag_[4]{};
-    if(!file->read(tag_, 4) || file->gcount() != 4 || memcmp(tag_, "RIFF", 4) != 0)
+    if(source->read(tag_, 4) != 4 || memcmp(tag_, "RIFF", 4) != 0)
         return nullptr;
-    ALuint totalsize = read_le32(*file) & ~1u;
-    if(!file->read(tag_, 4) || file->gcount() != 4 || memcmp(tag_, "WAVE", 4) != 0)
+    ALuint totalsize = read_le32(*source) & ~1u;
+    if(source->read(tag_, 4) != 4 || memcmp(tag_, "WAVE", 4) != 0)
         return nullptr;
 
-    while(file->good() && !file->eof() && totalsize > 8)
+    while(totalsize > 8)
     {
-        if(!file->read(tag_, 4) || file->gcount() != 4)
+        if(source->read(tag_, 4) != 4)
             return nullptr;
-        ALuint size = read_le32(*file);
+        ALuint size = read_le32(*source);
         if(size < 2) return nullptr;
         totalsize -= 8;
 
@@ -232,21 +281,21 @@ SharedPtr<Decoder> WaveDecoderFactory::createDecoder(UniquePtr<std::istream> &fi
             /* 'fmt ' tag needs at least 16 bytes. */
             if(size < 16) goto next_chunk;
 
-            int fmttype = read_le16(*file); size -= 2;
-            int chancount = read_le16(*file); size -= 2;
-            frequency = read_le32(*file); size -= 4;
+            int fmttype = read_le16(*source); size -= 2;
+            int chancount = read_le16(*source); size -= 2;
+            frequency = read_le32(*source); size -= 4;
 
             /* skip average bytes per second */
-            read_le32(*file); size -= 4;
+            read_le32(*source); size -= 4;
 
-            blockalign = read_le16(*file); size -= 2;
-            int bitdepth = read_le16(*file); size -= 2;
+            blockalign = read_le16(*source); size -= 2;
+            int bitdepth = read_le16(*source); size -= 2;
 
             /* Look for any extra data and try to find the format */
             ALuint extrabytes = 0;
             if(size >= 2)
             {
-                extrabytes = read_le16(*file);
+                extrabytes = read_le16(*source);
                 size -= 2;
             }
             extrabytes = std::min<ALuint>(extrabytes, size);
@@ -300,10 +349,9 @@ SharedPtr<Decoder> WaveDecoderFactory::createDecoder(UniquePtr<std::istream> &fi
                 if(size < 22) goto next_chunk;
 
                 ALubyte subtype[16];
-                ALushort validbits = read_le16(*file); size -= 2;
-                ALuint chanmask = read_le32(*file); size -= 4;
-                file->read(reinterpret_cast<char*>(subtype), 16);
-                size -= static_cast<ALuint>(file->gcount());
+                ALushort validbits = read_le16(*source); size -= 2;
+                ALuint chanmask = read_le32(*source); size -= 4;
+                size -= static_cast<ALuint>(source->read(subtype, 16));
 
                 /* Padded bit depths not supported */
                 if(validbits != bitdepth)
@@ -374,25 +422,25 @@ SharedPtr<Decoder> WaveDecoderFactory::createDecoder(UniquePtr<std::istream> &fi
 
             /* Most of this only affects MIDI sampling, but we only care about
              * the loop definitions at the end. */
-            /*ALuint manufacturer =*/ read_le32(*file);
-            /*ALuint product =*/ read_le32(*file);
-            /*ALuint smpperiod =*/ read_le32(*file);
-            /*ALuint unitynote =*/ read_le32(*file);
-            /*ALuint pitchfrac =*/ read_le32(*file);
-            /*ALuint smptefmt =*/ read_le32(*file);
-            /*ALuint smpteoffset =*/ read_le32(*file);
-            ALuint loopcount = read_le32(*file);
-            /*ALuint extrabytes =*/ read_le32(*file);
+            /*ALuint manufacturer =*/ read_le32(*source);
+            /*ALuint product =*/ read_le32(*source);
+            /*ALuint smpperiod =*/ read_le32(*source);
+            /*ALuint unitynote =*/ read_le32(*source);
+            /*ALuint pitchfrac =*/ read_le32(*source);
+            /*ALuint smptefmt =*/ read_le32(*source);
+            /*ALuint smpteoffset =*/ read_le32(*source);
+            ALuint loopcount = read_le32(*source);
+            /*ALuint extrabytes =*/ read_le32(*source);
             size -= 36;
 
             for(ALuint i = 0;i < loopcount && size >= 24;++i)
             {
-                /*ALuint id =*/ read_le32(*file);
-                ALuint type = read_le32(*file);
-                ALuint loopstart = read_le32(*file);
-                ALuint loopend = read_le32(*file);
-                /*ALuint frac =*/ read_le32(*file);
-                ALuint numloops = read_le32(*file);
+                /*ALuint id =*/ read_le32(*source);
+                ALuint type = read_le32(*source);
+                ALuint loopstart = read_le32(*source);
+                ALuint loopend = read_le32(*source);
+                /*ALuint frac =*/ read_le32(*source);
+                ALuint numloops = read_le32(*source);
                 size -= 24;
 
                 /* Only handle indefinite forward loops. */
@@ -406,18 +454,31 @@ SharedPtr<Decoder> WaveDecoderFactory::createDecoder(UniquePtr<std::istream> &fi
         }
         else if(tag == "data")
         {
-            if(framesize == 0 || !Context::GetCurrent().isSupported(channels, type))
+            if(framesize == 0)
                 goto next_chunk;
 
+            /* Formats the device can't take directly are decoded to 16-bit,
+             * if it can take that instead. */
+            SampleType outtype = type;
+            if(!Context::GetCurrent().isSupported(channels, type))
+            {
+                if(type == SampleType::Int16 ||
+                   !Context::GetCurrent().isSupported(channels, SampleType::Int16))
+                    goto next_chunk;
+                outtype = SampleType::Int16;
+            }
+
             /* Make sure there's at least one sample frame of audio data. */
-            std::istream::pos_type start = file->tellg();
-            std::istream::pos_type end = start + std::istream::pos_type(size - (size%framesize));
+            uint64_t start = source->tell();
+            if(start == ByteSource::InvalidPos)
+                return nullptr;
+            uint64_t end = start + (size - (size%framesize));
             if(end-start >= framesize)
             {
                 /* Loop points are byte offsets relative to the data start.
                  * Convert to sample frame offsets. */
-                return MakeShared<WaveDecoder>(std::move(file),
-                    channels, type, frequency, framesize, start, end,
+                return MakeShared<WaveDecoder>(std::move(file), std::move(source),
+                    channels, outtype, type, frequency, framesize, start, end,
                     loop_pts[0] / blockalign * framealign,
                     loop_pts[1] / blockalign * framealign
                 );
@@ -426,8 +487,8 @@ SharedPtr<Decoder> WaveDecoderFactory::createDecoder(UniquePtr<std::istream> &fi
 
     next_chunk:
         size += padbyte;
-        if(size > 0)
-            file->ignore(size);
+        if(size > 0 && !source->skip(size))
+            return nullptr;
     }
 
     return nullptr;
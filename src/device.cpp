@@ -35,6 +35,11 @@ void LoadPauseDevice(DeviceImpl *device)
     LoadALCFunc(device->getALCdevice(), &device->alcDeviceResumeSOFT, "alcDeviceResumeSOFT");
 }
 
+void LoadDeviceClock(DeviceImpl *device)
+{
+    LoadALCFunc(device->getALCdevice(), &device->alcGetInteger64vSOFT, "alcGetInteger64vSOFT");
+}
+
 void LoadNothing(DeviceImpl*) { }
 
 static const struct {
@@ -47,6 +52,7 @@ static const struct {
     { ALC::EXT_thread_local_context, "ALC_EXT_thread_local_context", LoadNothing },
     { ALC::SOFT_HRTF, "ALC_SOFT_HRTF", LoadHrtf },
     { ALC::SOFT_pause_device, "ALC_SOFT_pause_device", LoadPauseDevice },
+    { ALC::SOFT_device_clock, "ALC_SOFT_device_clock", LoadDeviceClock },
 };
 
 } // namespace
@@ -14,6 +14,7 @@ enum class ALC {
     EXT_thread_local_context,
     SOFT_HRTF,
     SOFT_pause_device,
+    SOFT_device_clock,
 
     EXTENSION_MAX
 };
@@ -45,6 +46,8 @@ public:
     LPALCGETSTRINGISOFT alcGetStringiSOFT{nullptr};
     LPALCRESETDEVICESOFT alcResetDeviceSOFT{nullptr};
 
+    LPALCGETINTEGER64VSOFT alcGetInteger64vSOFT{nullptr};
+
     void removeContext(ContextImpl *ctx);
 
     String getName(PlaybackName type) const;
@@ -0,0 +1,145 @@
+
+#include "config.h"
+
+#include "fade.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2_INTRINSICS
+#endif
+
+namespace {
+
+using alure::FadeShape;
+using alure::SourceFadeUpdateEntry;
+
+// The lowest gain an exponential ramp starts or ends at (-80dB), since it
+// can't reach 0.
+constexpr ALfloat MinExpGain = 0.0001f;
+
+// Approximates 2^x, by splitting x into a rounded integer part applied to the
+// exponent, and a fractional part in [-0.5, +0.5] for a 5th order polynomial
+// (relative error under 3e-6).
+constexpr float Exp2C1 = 6.931471806e-01f;
+constexpr float Exp2C2 = 2.402265070e-01f;
+constexpr float Exp2C3 = 5.550410866e-02f;
+constexpr float Exp2C4 = 9.618129108e-03f;
+constexpr float Exp2C5 = 1.333355815e-03f;
+
+inline float FastExp2(float x)
+{
+    x = std::min(std::max(x, -126.0f), 126.0f);
+    float ipart = std::nearbyint(x);
+    float f = x - ipart;
+    float p = 1.0f + f*(Exp2C1 + f*(Exp2C2 + f*(Exp2C3 + f*(Exp2C4 + f*Exp2C5))));
+    return std::ldexp(p, static_cast<int>(ipart));
+}
+
+// Gets the progress, from 0 to 1, through the fade's duration.
+inline float GetFadeProgress(const SourceFadeUpdateEntry &fade, std::chrono::nanoseconds cur_time)
+{
+    auto elapsed = cur_time - fade.mFadeTimeStart;
+    auto duration = fade.mFadeTimeTarget - fade.mFadeTimeStart;
+    if(elapsed.count() <= 0) return 0.0f;
+    if(elapsed >= duration) return 1.0f;
+    return static_cast<float>(static_cast<double>(elapsed.count()) / duration.count());
+}
+
+inline float CalcFadeGain(const SourceFadeUpdateEntry &fade, float t)
+{
+    if(t >= 1.0f) return fade.mGainTarget;
+    switch(fade.mShape)
+    {
+        case FadeShape::Linear:
+            break;
+        case FadeShape::Exponential:
+            return std::max(fade.mGainStart, MinExpGain) * FastExp2(t * fade.mGainLog2Ratio);
+        case FadeShape::SCurve:
+            t = t*t*(3.0f - 2.0f*t);
+            break;
+    }
+    return fade.mGainStart + (fade.mGainTarget-fade.mGainStart)*t;
+}
+
+#ifdef HAVE_SSE2_INTRINSICS
+inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{ return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+
+inline __m128 FastExp2(__m128 x)
+{
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.0f)), _mm_set1_ps(126.0f));
+    __m128i ipart = _mm_cvtps_epi32(x);
+    __m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(ipart));
+
+    __m128 p = _mm_set1_ps(Exp2C5);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(Exp2C4));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(Exp2C3));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(Exp2C2));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(Exp2C1));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+    __m128i scale = _mm_slli_epi32(_mm_add_epi32(ipart, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+}
+#endif
+
+} // namespace
+
+namespace alure {
+
+SourceFadeUpdateEntry MakeFadeEntry(SourceImpl *source, ALfloat start_gain, ALfloat target_gain,
+                                    std::chrono::nanoseconds start_time,
+                                    std::chrono::nanoseconds duration, FadeShape shape,
+                                    bool stop_at_end)
+{
+    ALfloat ratio = std::max(target_gain, MinExpGain) / std::max(start_gain, MinExpGain);
+    return SourceFadeUpdateEntry{source, start_time, start_time+duration, start_gain,
+        target_gain, std::log2(ratio), shape, stop_at_end};
+}
+
+void CalcFadeGains(const SourceFadeUpdateEntry *fades, size_t count,
+                   std::chrono::nanoseconds cur_time, ALfloat *gains)
+{
+    size_t i = 0;
+#ifdef HAVE_SSE2_INTRINSICS
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 three = _mm_set1_ps(3.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 minexp = _mm_set1_ps(MinExpGain);
+    for(;i+4 <= count;i += 4)
+    {
+        const SourceFadeUpdateEntry *f = fades + i;
+        __m128 t = _mm_setr_ps(GetFadeProgress(f[0], cur_time), GetFadeProgress(f[1], cur_time),
+                               GetFadeProgress(f[2], cur_time), GetFadeProgress(f[3], cur_time));
+        __m128 start = _mm_setr_ps(f[0].mGainStart, f[1].mGainStart, f[2].mGainStart,
+                                   f[3].mGainStart);
+        __m128 target = _mm_setr_ps(f[0].mGainTarget, f[1].mGainTarget, f[2].mGainTarget,
+                                    f[3].mGainTarget);
+        __m128 lratio = _mm_setr_ps(f[0].mGainLog2Ratio, f[1].mGainLog2Ratio,
+                                    f[2].mGainLog2Ratio, f[3].mGainLog2Ratio);
+        __m128 isexp = _mm_castsi128_ps(_mm_setr_epi32(
+            -(f[0].mShape == FadeShape::Exponential), -(f[1].mShape == FadeShape::Exponential),
+            -(f[2].mShape == FadeShape::Exponential), -(f[3].mShape == FadeShape::Exponential)));
+        __m128 isscurve = _mm_castsi128_ps(_mm_setr_epi32(
+            -(f[0].mShape == FadeShape::SCurve), -(f[1].mShape == FadeShape::SCurve),
+            -(f[2].mShape == FadeShape::SCurve), -(f[3].mShape == FadeShape::SCurve)));
+
+        __m128 smooth = _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(three, _mm_mul_ps(two, t)));
+        __m128 lt = Select(isscurve, smooth, t);
+        __m128 lin = _mm_add_ps(start, _mm_mul_ps(_mm_sub_ps(target, start), lt));
+        __m128 expo = _mm_mul_ps(_mm_max_ps(start, minexp), FastExp2(_mm_mul_ps(t, lratio)));
+
+        __m128 gain = Select(isexp, expo, lin);
+        gain = Select(_mm_cmpge_ps(t, one), target, gain);
+        _mm_storeu_ps(&gains[i], _mm_max_ps(gain, zero));
+    }
+#endif
+    for(;i < count;++i)
+        gains[i] = std::max(CalcFadeGain(fades[i], GetFadeProgress(fades[i], cur_time)), 0.0f);
+}
+
+} // namespace alure
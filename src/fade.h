@@ -0,0 +1,37 @@
+#ifndef FADE_H
+#define FADE_H
+
+#include "main.h"
+
+namespace alure {
+
+class SourceImpl;
+
+// A gain ramp applied on top of a source's own gain. The ramp parameters are
+// precalculated when the fade starts, so evaluating it needs no pow calls.
+struct SourceFadeUpdateEntry {
+    SourceImpl *mSource;
+
+    std::chrono::nanoseconds mFadeTimeStart;
+    std::chrono::nanoseconds mFadeTimeTarget;
+    ALfloat mGainStart;
+    ALfloat mGainTarget;
+    // log2(target/start), with the gains kept above silence, for exponential
+    // ramps.
+    ALfloat mGainLog2Ratio;
+    FadeShape mShape;
+    bool mStopAtEnd;
+};
+
+SourceFadeUpdateEntry MakeFadeEntry(SourceImpl *source, ALfloat start_gain, ALfloat target_gain,
+                                    std::chrono::nanoseconds start_time,
+                                    std::chrono::nanoseconds duration, FadeShape shape,
+                                    bool stop_at_end);
+
+// Calculates the current gain of each fade, at the given device clock time.
+void CalcFadeGains(const SourceFadeUpdateEntry *fades, size_t count,
+                   std::chrono::nanoseconds cur_time, ALfloat *gains);
+
+} // namespace alure
+
+#endif /* FADE_H */
@@ -0,0 +1,88 @@
+
+#include "config.h"
+
+#include "fileprefetch.h"
+
+#include <thread>
+
+#ifdef HAVE_PREAD
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#endif
+
+namespace alure {
+
+// Reads are done in pieces of this size, so a large file doesn't keep the
+// prefetcher from quitting.
+constexpr size_t PrefetchReadSize = 256*1024;
+
+constexpr size_t FilePrefetcher::MaxThreads;
+
+FilePrefetcher::~FilePrefetcher()
+{
+    // Running threads stop after their current read, without being waited
+    // on.
+    std::lock_guard<std::mutex> lock(mState->mMutex);
+    mState->mQuit.store(true, std::memory_order_release);
+    mState->mQueue.clear();
+}
+
+void FilePrefetcher::add(ArrayView<StringView> names)
+{
+    if(names.empty()) return;
+
+    std::lock_guard<std::mutex> lock(mState->mMutex);
+    for(const StringView name : names)
+        mState->mQueue.emplace_back(name);
+
+    // Start enough threads to read everything queued at once, up to the
+    // limit. The running ones keep taking files until the queue is empty.
+    while(mState->mNumThreads < MaxThreads && mState->mNumThreads < mState->mQueue.size())
+    {
+        std::thread(&FilePrefetcher::run, mState).detach();
+        ++mState->mNumThreads;
+    }
+}
+
+void FilePrefetcher::run(SharedPtr<State> state)
+{
+    Vector<ALbyte> scratch(PrefetchReadSize);
+
+    std::unique_lock<std::mutex> lock(state->mMutex);
+    while(!state->mQuit.load(std::memory_order_acquire) && !state->mQueue.empty())
+    {
+        String name = std::move(state->mQueue.front());
+        state->mQueue.pop_front();
+        lock.unlock();
+
+        readFile(*state, name, scratch);
+
+        lock.lock();
+    }
+    --state->mNumThreads;
+}
+
+void FilePrefetcher::readFile(const State &state, const String &name, Vector<ALbyte> &scratch)
+{
+#ifdef HAVE_PREAD
+    int fd = open(name.c_str(), O_RDONLY);
+    if(fd < 0) return;
+
+    off_t offset = 0;
+    ssize_t got;
+    while(!state.mQuit.load(std::memory_order_acquire) &&
+          (got=pread(fd, scratch.data(), scratch.size(), offset)) > 0)
+        offset += got;
+    close(fd);
+#else
+    std::ifstream file(name.c_str(), std::ios::binary);
+    while(!state.mQuit.load(std::memory_order_acquire) &&
+          file.read(reinterpret_cast<char*>(scratch.data()), scratch.size()))
+    {
+    }
+#endif
+}
+
+} // namespace alure
@@ -0,0 +1,48 @@
+#ifndef FILEPREFETCH_H
+#define FILEPREFETCH_H
+
+#include "main.h"
+
+#include <atomic>
+#include <mutex>
+#include <deque>
+
+namespace alure {
+
+// Reads files ahead of time on a pool of threads, so they're in the system's
+// file cache by the time they're opened and decoded. Many files are read at
+// once, which hides the latency of slow or networked storage better than
+// reading them one after another. The data read is discarded, so memory use
+// doesn't grow with the number or size of the files.
+//
+// The threads are detached, and exit once the queue is empty. The prefetcher
+// never waits on them, so it's safe to destroy from a static destructor,
+// where joining a thread could deadlock (e.g. under a DLL's loader lock).
+class FilePrefetcher {
+    // Shared with the threads, so it outlives the prefetcher while they
+    // finish up.
+    struct State {
+        std::mutex mMutex;
+        std::deque<String> mQueue;
+        size_t mNumThreads{0};
+        std::atomic<bool> mQuit{false};
+    };
+    SharedPtr<State> mState;
+
+    static void run(SharedPtr<State> state);
+    static void readFile(const State &state, const String &name, Vector<ALbyte> &scratch);
+
+public:
+    // The most files read at once.
+    static constexpr size_t MaxThreads = 16;
+
+    FilePrefetcher() : mState(MakeShared<State>()) { }
+    ~FilePrefetcher();
+
+    // Queues the named files to be read, in order.
+    void add(ArrayView<StringView> names);
+};
+
+} // namespace alure
+
+#endif /* FILEPREFETCH_H */
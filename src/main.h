@@ -39,16 +39,24 @@ ret C::Name(T1 a, T2 b, T3 c) cv                                              \
     return pImpl->Name(std::forward<T1>(a), std::forward<T2>(b),              \
                        std::forward<T3>(c));                                  \
 }
+#define DECL_THUNK4(ret, C, Name, cv, T1, T2, T3, T4)                         \
+ret C::Name(T1 a, T2 b, T3 c, T4 d) cv                                        \
+{                                                                             \
+    return pImpl->Name(std::forward<T1>(a), std::forward<T2>(b),              \
+                       std::forward<T3>(c), std::forward<T4>(d));             \
+}
 
 
 namespace alure {
 
 // Need to use these to avoid extraneous commas in macro parameter lists
 using Vector3Pair = std::pair<Vector3,Vector3>;
+using UInt64Pair = std::pair<uint64_t,uint64_t>;
 using UInt64NSecPair = std::pair<uint64_t,std::chrono::nanoseconds>;
 using SecondsPair = std::pair<Seconds,Seconds>;
 using ALfloatPair = std::pair<ALfloat,ALfloat>;
 using ALuintPair = std::pair<ALuint,ALuint>;
+using MillisecondsPair = std::pair<std::chrono::milliseconds,std::chrono::milliseconds>;
 using BoolTriple = std::tuple<bool,bool,bool>;
 
 
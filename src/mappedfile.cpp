@@ -0,0 +1,159 @@
+
+#include "config.h"
+
+#include "mappedfile.h"
+
+#include <unordered_set>
+#include <streambuf>
+#include <limits>
+#include <mutex>
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+using alure::ArrayView;
+
+#ifdef HAVE_MMAP
+// The live mapped streams, to recognize them without RTTI, and without
+// touching the storage of streams that aren't ours.
+std::mutex gMappedLock;
+std::unordered_set<const std::istream*> gMappedStreams;
+
+class MappedStreamBuf final : public std::streambuf {
+    void *mData{MAP_FAILED};
+    size_t mSize{0};
+
+    // The whole file is the get area, so the default underflow returning EOF
+    // is all that's needed for reading.
+
+    pos_type seekoff(off_type offset, std::ios_base::seekdir whence, std::ios_base::openmode mode) override
+    {
+        off_type base;
+        switch(whence)
+        {
+            case std::ios_base::beg: base = 0; break;
+            case std::ios_base::cur: base = gptr() - eback(); break;
+            case std::ios_base::end: base = static_cast<off_type>(mSize); break;
+            default: return traits_type::eof();
+        }
+        return seekpos(base + offset, mode);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode mode) override
+    {
+        if(mData == MAP_FAILED || (mode&std::ios_base::out) || !(mode&std::ios_base::in))
+            return traits_type::eof();
+
+        off_type offset = pos;
+        if(offset < 0 || offset > static_cast<off_type>(mSize))
+            return traits_type::eof();
+
+        setg(eback(), eback()+offset, egptr());
+        return pos;
+    }
+
+public:
+    bool open(const char *filename)
+    {
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0) return false;
+
+        struct stat st;
+        if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+           static_cast<uint64_t>(st.st_size) > std::numeric_limits<size_t>::max())
+        {
+            close(fd);
+            return false;
+        }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping holds its own reference to the file.
+        close(fd);
+        if(ptr == MAP_FAILED) return false;
+
+        mData = ptr;
+        mSize = size;
+        char_type *base = static_cast<char_type*>(mData);
+        setg(base, base, base+mSize);
+        return true;
+    }
+
+    ArrayView<ALbyte> getData() const noexcept
+    {
+        if(mData == MAP_FAILED) return {};
+        return ArrayView<ALbyte>(static_cast<const ALbyte*>(mData), mSize);
+    }
+
+    MappedStreamBuf() = default;
+    ~MappedStreamBuf() override
+    {
+        if(mData != MAP_FAILED)
+            munmap(mData, mSize);
+        mData = MAP_FAILED;
+    }
+};
+
+class MappedStream final : public std::istream {
+    MappedStreamBuf mStreamBuf;
+
+public:
+    MappedStream() : std::istream(nullptr)
+    {
+        init(&mStreamBuf);
+        std::lock_guard<std::mutex> lock(gMappedLock);
+        gMappedStreams.insert(this);
+    }
+    ~MappedStream() override
+    {
+        std::lock_guard<std::mutex> lock(gMappedLock);
+        gMappedStreams.erase(this);
+    }
+
+    bool open(const char *filename)
+    {
+        if(mStreamBuf.open(filename))
+            return true;
+        clear(failbit);
+        return false;
+    }
+
+    ArrayView<ALbyte> getData() const noexcept { return mStreamBuf.getData(); }
+};
+#endif
+
+} // namespace
+
+namespace alure {
+
+UniquePtr<std::istream> OpenMappedFile(const char *filename) noexcept
+{
+#ifdef HAVE_MMAP
+    auto file = MakeUnique<MappedStream>();
+    if(file->open(filename))
+        return file;
+#else
+    (void)filename;
+#endif
+    return nullptr;
+}
+
+ArrayView<ALbyte> GetStreamMapping(std::istream &stream) noexcept
+{
+#ifdef HAVE_MMAP
+    std::lock_guard<std::mutex> lock(gMappedLock);
+    if(gMappedStreams.find(&stream) != gMappedStreams.end())
+        return static_cast<MappedStream&>(stream).getData();
+#else
+    (void)stream;
+#endif
+    return {};
+}
+
+} // namespace alure
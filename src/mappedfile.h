@@ -0,0 +1,22 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include "main.h"
+
+#include <istream>
+
+namespace alure {
+
+// Opens a file as a read-only memory mapping, read through an istream. The
+// stream's reads copy straight from the mapping, without any system calls.
+// Returns null if the file can't be mapped (it isn't a regular file, it's
+// empty, or mapping isn't supported), so it can be opened another way.
+UniquePtr<std::istream> OpenMappedFile(const char *filename) noexcept;
+
+// Returns the whole mapped file a stream from OpenMappedFile reads from. For
+// any other stream, returns an empty view.
+ArrayView<ALbyte> GetStreamMapping(std::istream &stream) noexcept;
+
+} // namespace alure
+
+#endif /* MAPPEDFILE_H */
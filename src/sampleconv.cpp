@@ -0,0 +1,250 @@
+
+#include "config.h"
+
+#include "sampleconv.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HAVE_SSE2_INTRINSICS
+#endif
+
+namespace {
+
+using alure::Array;
+
+inline ALshort ClampToS16(ALfloat val)
+{
+    val = std::min(std::max(val, -32768.0f), 32767.0f);
+    return static_cast<ALshort>(std::lrint(val));
+}
+
+Array<ALshort,256> MakeMulawTable()
+{
+    Array<ALshort,256> table;
+    for(size_t i = 0;i < table.size();++i)
+    {
+        ALuint val = ~static_cast<ALuint>(i);
+        ALint sample = ((((val&0x0f) << 3) + 0x84) << ((val>>4)&0x07)) - 0x84;
+        table[i] = static_cast<ALshort>((val&0x80) ? -sample : sample);
+    }
+    return table;
+}
+
+template<typename T>
+void DoPermute(T *samples, size_t frames, ALuint channels, const ALubyte *order)
+{
+    T temp[16];
+    if(channels > 16) return;
+    for(size_t i = 0;i < frames;++i)
+    {
+        std::copy(samples, samples+channels, temp);
+        for(ALuint c = 0;c < channels;++c)
+            samples[c] = temp[order[c]];
+        samples += channels;
+    }
+}
+
+// As above, for orders known at compile time. The indices being constant
+// lets the compiler keep each frame in registers.
+template<ALubyte ...Order, typename T>
+void DoPermute(T *samples, size_t frames)
+{
+    constexpr size_t N{sizeof...(Order)};
+    for(size_t i = 0;i < frames;++i)
+    {
+        const T temp[N]{samples[Order]...};
+        std::copy(temp, temp+N, samples);
+        samples += N;
+    }
+}
+
+// OpenAL : FL, FR, FC, LFE, RL, RR
+// Vorbis : FL, FC, FR,  RL, RR, LFE
+const ALubyte VorbisOrder51[6]{ 0, 2, 1, 5, 3, 4 };
+// OpenAL : FL, FR, FC, LFE, RC, SL, SR
+// Vorbis : FL, FC, FR,  SL, SR, RC, LFE
+const ALubyte VorbisOrder61[7]{ 0, 2, 1, 6, 5, 3, 4 };
+// OpenAL : FL, FR, FC, LFE, RL, RR, SL, SR
+// Vorbis : FL, FC, FR,  SL, SR, RL, RR, LFE
+const ALubyte VorbisOrder71[8]{ 0, 2, 1, 7, 5, 6, 3, 4 };
+
+// Same as the above tables.
+template<typename T>
+void DoVorbisReorder(T *samples, size_t frames, alure::ChannelConfig chans)
+{
+    switch(chans)
+    {
+        case alure::ChannelConfig::X51: DoPermute<0,2,1,5,3,4>(samples, frames); break;
+        case alure::ChannelConfig::X61: DoPermute<0,2,1,6,5,3,4>(samples, frames); break;
+        case alure::ChannelConfig::X71: DoPermute<0,2,1,7,5,6,3,4>(samples, frames); break;
+        default: break;
+    }
+}
+
+} // namespace
+
+namespace alure {
+
+void ConvertF32ToS16(ALshort *dst, const ALfloat *src, size_t count)
+{
+    size_t i = 0;
+#ifdef HAVE_SSE2_INTRINSICS
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    const __m128 minval = _mm_set1_ps(-32768.0f);
+    const __m128 maxval = _mm_set1_ps(32767.0f);
+    for(;i+8 <= count;i += 8)
+    {
+        // Clamp before converting, since out-of-range values would otherwise
+        // convert to the minimum.
+        __m128 lo = _mm_mul_ps(_mm_loadu_ps(&src[i]), scale);
+        __m128 hi = _mm_mul_ps(_mm_loadu_ps(&src[i+4]), scale);
+        lo = _mm_max_ps(_mm_min_ps(lo, maxval), minval);
+        hi = _mm_max_ps(_mm_min_ps(hi, maxval), minval);
+        __m128i out = _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&dst[i]), out);
+    }
+#endif
+    for(;i < count;++i)
+        dst[i] = ClampToS16(src[i] * 32768.0f);
+}
+
+void ConvertF32ToS16Dither(ALshort *dst, const ALfloat *src, size_t count, ALuint &seed)
+{
+    const ALfloat invscale = 1.0f / 4294967296.0f;
+    ALuint state = seed;
+    for(size_t i = 0;i < count;++i)
+    {
+        ALuint rng0 = state = state*96314165u + 907633515u;
+        ALuint rng1 = state = state*96314165u + 907633515u;
+        ALfloat noise = static_cast<ALfloat>(rng0)*invscale - static_cast<ALfloat>(rng1)*invscale;
+        dst[i] = ClampToS16(src[i]*32768.0f + noise);
+    }
+    seed = state;
+}
+
+void ConvertS16ToF32(ALfloat *dst, const ALshort *src, size_t count)
+{
+    size_t i = 0;
+#ifdef HAVE_SSE2_INTRINSICS
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for(;i+8 <= count;i += 8)
+    {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+        // Move each sample to the top half of a 32-bit lane, then shift it
+        // back down to sign-extend it.
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16);
+        _mm_storeu_ps(&dst[i], _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(&dst[i+4], _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#endif
+    for(;i < count;++i)
+        dst[i] = static_cast<ALfloat>(src[i]) * (1.0f/32768.0f);
+}
+
+void ConvertU8ToS16(ALshort *dst, const ALubyte *src, size_t count)
+{
+    size_t i = 0;
+#ifdef HAVE_SSE2_INTRINSICS
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i signbit = _mm_set1_epi16(-32768);
+    for(;i+16 <= count;i += 16)
+    {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+        // Put each byte in the top of a 16-bit lane and flip the sign bit.
+        __m128i lo = _mm_xor_si128(_mm_unpacklo_epi8(zero, in), signbit);
+        __m128i hi = _mm_xor_si128(_mm_unpackhi_epi8(zero, in), signbit);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&dst[i]), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&dst[i+8]), hi);
+    }
+#endif
+    for(;i < count;++i)
+        dst[i] = static_cast<ALshort>((src[i]^0x80) << 8);
+}
+
+void ConvertMulawToS16(ALshort *dst, const ALubyte *src, size_t count)
+{
+    static const Array<ALshort,256> table = MakeMulawTable();
+    for(size_t i = 0;i < count;++i)
+        dst[i] = table[src[i]];
+}
+
+void ByteSwap16(ALvoid *data, size_t count)
+{
+    ALushort *samples = static_cast<ALushort*>(data);
+    for(size_t i = 0;i < count;++i)
+        samples[i] = static_cast<ALushort>((samples[i]>>8) | (samples[i]<<8));
+}
+
+void ByteSwap32(ALvoid *data, size_t count)
+{
+    ALuint *samples = static_cast<ALuint*>(data);
+    for(size_t i = 0;i < count;++i)
+    {
+        ALuint val = samples[i];
+        samples[i] = (val>>24) | ((val>>8)&0x0000ff00u) | ((val<<8)&0x00ff0000u) | (val<<24);
+    }
+}
+
+void PermuteChannels(ALshort *samples, size_t frames, ALuint channels, const ALubyte *order)
+{ DoPermute(samples, frames, channels, order); }
+void PermuteChannels(ALfloat *samples, size_t frames, ALuint channels, const ALubyte *order)
+{ DoPermute(samples, frames, channels, order); }
+
+void ReorderVorbisChannels(ALshort *samples, size_t frames, ChannelConfig chans)
+{ DoVorbisReorder(samples, frames, chans); }
+void ReorderVorbisChannels(ALfloat *samples, size_t frames, ChannelConfig chans)
+{ DoVorbisReorder(samples, frames, chans); }
+
+void Interleave(ALfloat *dst, const ALfloat *const *src, ALuint channels, size_t frames,
+                const ALubyte *order)
+{
+#ifdef HAVE_SSE2_INTRINSICS
+    if(channels == 2)
+    {
+        const ALfloat *left = src[order ? order[0] : 0];
+        const ALfloat *right = src[order ? order[1] : 1];
+        size_t i = 0;
+        for(;i+4 <= frames;i += 4)
+        {
+            __m128 l = _mm_loadu_ps(&left[i]);
+            __m128 r = _mm_loadu_ps(&right[i]);
+            _mm_storeu_ps(&dst[i*2], _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(&dst[i*2 + 4], _mm_unpackhi_ps(l, r));
+        }
+        for(;i < frames;++i)
+        {
+            dst[i*2] = left[i];
+            dst[i*2 + 1] = right[i];
+        }
+        return;
+    }
+#endif
+    for(ALuint c = 0;c < channels;++c)
+    {
+        const ALfloat *in = src[order ? order[c] : c];
+        ALfloat *out = dst + c;
+        for(size_t i = 0;i < frames;++i)
+            out[i*channels] = in[i];
+    }
+}
+
+const ALubyte *GetVorbisChannelOrder(ChannelConfig chans) noexcept
+{
+    // 1, 2, and 4 channel files decode into the same channel order as
+    // OpenAL, however 6 (5.1), 7 (6.1), and 8 (7.1) channel files need to be
+    // re-ordered.
+    switch(chans)
+    {
+        case ChannelConfig::X51: return VorbisOrder51;
+        case ChannelConfig::X61: return VorbisOrder61;
+        case ChannelConfig::X71: return VorbisOrder71;
+        default: break;
+    }
+    return nullptr;
+}
+
+} // namespace alure
@@ -0,0 +1,47 @@
+#ifndef SAMPLECONV_H
+#define SAMPLECONV_H
+
+#include "main.h"
+
+namespace alure {
+
+// Sample format conversions shared by the decoders. Counts are in samples,
+// not frames, and the source and destination must not overlap unless noted.
+
+// Converts float samples in [-1, 1] to 16-bit, clamping out-of-range values.
+void ConvertF32ToS16(ALshort *dst, const ALfloat *src, size_t count);
+// As above, adding triangular dither before rounding. The seed holds the
+// noise generator's state between calls.
+void ConvertF32ToS16Dither(ALshort *dst, const ALfloat *src, size_t count, ALuint &seed);
+void ConvertS16ToF32(ALfloat *dst, const ALshort *src, size_t count);
+
+// Expands unsigned 8-bit and mu-law samples to 16-bit.
+void ConvertU8ToS16(ALshort *dst, const ALubyte *src, size_t count);
+void ConvertMulawToS16(ALshort *dst, const ALubyte *src, size_t count);
+
+// Reverses the byte order of each 16- or 32-bit sample, in place.
+void ByteSwap16(ALvoid *data, size_t count);
+void ByteSwap32(ALvoid *data, size_t count);
+
+// Reorders the channels of each frame in place, so output channel c comes
+// from input channel order[c].
+void PermuteChannels(ALshort *samples, size_t frames, ALuint channels, const ALubyte *order);
+void PermuteChannels(ALfloat *samples, size_t frames, ALuint channels, const ALubyte *order);
+
+// Interleaves separate channel buffers into dst, so output channel c comes
+// from src[order[c]]. A null order keeps the channels as they are.
+void Interleave(ALfloat *dst, const ALfloat *const *src, ALuint channels, size_t frames,
+                const ALubyte *order);
+
+// Returns how to reorder the channels of the given configuration from the
+// Vorbis channel order (also used by Opus) to OpenAL's, for use with the
+// above. Returns null for configurations that already match.
+const ALubyte *GetVorbisChannelOrder(ChannelConfig chans) noexcept;
+// Reorders interleaved samples from the Vorbis channel order to OpenAL's, in
+// place. Faster than PermuteChannels with the above order.
+void ReorderVorbisChannels(ALshort *samples, size_t frames, ChannelConfig chans);
+void ReorderVorbisChannels(ALfloat *samples, size_t frames, ChannelConfig chans);
+
+} // namespace alure
+
+#endif /* SAMPLECONV_H */
@@ -0,0 +1,92 @@
+
+#include "config.h"
+
+#include "shareddecoder.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace alure {
+
+SharedDecodeStream::SharedDecodeStream(SharedPtr<Decoder> decoder, ALuint framesize,
+                                       ALuint windowlen)
+  : mDecoder(std::move(decoder)), mFrameSize(framesize), mWindowLen(windowlen)
+  , mFrequency(mDecoder->getFrequency()), mChannels(mDecoder->getChannelConfig())
+  , mSampleType(mDecoder->getSampleType()), mLength(mDecoder->getLength())
+{
+    mData.resize(static_cast<size_t>(mWindowLen) * mFrameSize);
+}
+
+void SharedDecodeStream::copyOut(ALbyte *dst, uint64_t pos, ALuint count) const
+{
+    size_t offset = static_cast<size_t>(pos % mWindowLen);
+    size_t todo = std::min<size_t>(count, mWindowLen - offset);
+    memcpy(dst, &mData[offset*mFrameSize], todo*mFrameSize);
+    if(todo < count)
+        memcpy(dst + todo*mFrameSize, &mData[0], (count-todo)*mFrameSize);
+}
+
+ALuint SharedDecodeStream::decodeMore(ALuint count)
+{
+    // Decode at least a quarter of the window at a time, so taps reading in
+    // small pieces don't each end up calling into the decoder.
+    count = static_cast<ALuint>(std::min<uint64_t>(std::max<uint64_t>(count, mWindowLen/4),
+                                                   mWindowLen));
+
+    ALuint total = 0;
+    while(total < count && !mEnded)
+    {
+        size_t offset = static_cast<size_t>(mEnd % mWindowLen);
+        ALuint todo = static_cast<ALuint>(std::min<uint64_t>(count-total, mWindowLen-offset));
+        ALuint got = mDecoder->read(&mData[offset*mFrameSize], todo);
+        if(got < todo) mEnded = true;
+
+        mEnd += got;
+        mStart = std::max(mStart, mEnd - std::min(mEnd, mWindowLen));
+        total += got;
+    }
+    return total;
+}
+
+uint64_t SharedDecodeStream::getStart()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStart;
+}
+
+bool SharedDecodeStream::seek(uint64_t &pos, uint64_t newpos)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(newpos < mStart || newpos > mEnd)
+        return false;
+    pos = newpos;
+    return true;
+}
+
+ALuint SharedDecodeStream::read(uint64_t &pos, ALvoid *ptr, ALuint count)
+{
+    ALbyte *dst = static_cast<ALbyte*>(ptr);
+    ALuint total = 0;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    while(total < count)
+    {
+        if(pos < mStart)
+            pos = mStart;
+        if(pos == mEnd)
+        {
+            // Decoding at most a window's worth keeps pos inside the window.
+            if(mEnded || decodeMore(count-total) == 0)
+                break;
+            continue;
+        }
+
+        ALuint todo = static_cast<ALuint>(std::min<uint64_t>(count-total, mEnd-pos));
+        copyOut(dst + static_cast<size_t>(total)*mFrameSize, pos, todo);
+        pos += todo;
+        total += todo;
+    }
+    return total;
+}
+
+} // namespace alure
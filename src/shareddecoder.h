@@ -0,0 +1,88 @@
+#ifndef SHAREDDECODER_H
+#define SHAREDDECODER_H
+
+#include "main.h"
+
+#include <mutex>
+
+namespace alure {
+
+// Decodes a stream once into a window of recent sample frames, which any
+// number of taps read from at their own positions. Whichever tap first reads
+// past the decoded end decodes more, pushing the oldest frames out of the
+// window.
+class SharedDecodeStream {
+    SharedPtr<Decoder> mDecoder;
+    std::mutex mMutex;
+
+    const ALuint mFrameSize;
+    const uint64_t mWindowLen;
+    Vector<ALbyte> mData;
+
+    // The decoder's format, taken at construction so taps can report it
+    // without locking.
+    const ALuint mFrequency;
+    const ChannelConfig mChannels;
+    const SampleType mSampleType;
+    const uint64_t mLength;
+
+    // The range of frames held in the window, guarded by mMutex.
+    uint64_t mStart{0};
+    uint64_t mEnd{0};
+    bool mEnded{false};
+
+    void copyOut(ALbyte *dst, uint64_t pos, ALuint count) const;
+    ALuint decodeMore(ALuint count);
+
+public:
+    SharedDecodeStream(SharedPtr<Decoder> decoder, ALuint framesize, ALuint windowlen);
+
+    ALuint getFrequency() const noexcept { return mFrequency; }
+    ChannelConfig getChannelConfig() const noexcept { return mChannels; }
+    SampleType getSampleType() const noexcept { return mSampleType; }
+    uint64_t getLength() const noexcept { return mLength; }
+
+    // Gets the oldest frame still held in the window.
+    uint64_t getStart();
+
+    // Moves pos to the given position if it's within the window.
+    bool seek(uint64_t &pos, uint64_t newpos);
+
+    // Reads count frames from pos, decoding more as needed, and advances pos.
+    // A pos that has fallen out of the window first skips to its start.
+    ALuint read(uint64_t &pos, ALvoid *ptr, ALuint count);
+};
+
+
+// A decoder reading from a shared stream, independently of the stream's
+// other taps.
+class SharedDecoderTap final : public Decoder {
+    SharedPtr<SharedDecodeStream> mStream;
+    uint64_t mPos;
+
+public:
+    SharedDecoderTap(SharedPtr<SharedDecodeStream> stream)
+      : mStream(std::move(stream)), mPos(mStream->getStart())
+    { }
+
+    ALuint getFrequency() const noexcept override { return mStream->getFrequency(); }
+    ChannelConfig getChannelConfig() const noexcept override
+    { return mStream->getChannelConfig(); }
+    SampleType getSampleType() const noexcept override { return mStream->getSampleType(); }
+
+    uint64_t getLength() const noexcept override { return mStream->getLength(); }
+    bool seek(uint64_t pos) noexcept override
+    { return mStream->seek(mPos, pos); }
+
+    // The stream can only be rewound within the window, so loop points aren't
+    // reported.
+    std::pair<uint64_t,uint64_t> getLoopPoints() const noexcept override
+    { return {0, 0}; }
+
+    ALuint read(ALvoid *ptr, ALuint count) noexcept override
+    { return mStream->read(mPos, ptr, count); }
+};
+
+} // namespace alure
+
+#endif /* SHAREDDECODER_H */
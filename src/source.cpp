@@ -13,12 +13,18 @@
 #include "buffer.h"
 #include "auxeffectslot.h"
 #include "sourcegroup.h"
+#include "decodeahead.h"
 
 namespace alure
 {
 
 class ALBufferStream {
+    ContextImpl &mContext;
     SharedPtr<Decoder> mDecoder;
+    SharedPtr<DecodeAhead> mAhead;
+    bool mIsAhead{false};
+    // Set while the ring taken from a prepared decoder is still at its start.
+    bool mPrerolled{false};
 
     ALsizei mUpdateLen{0};
     ALsizei mNumUpdates{0};
@@ -27,7 +33,6 @@ class ALBufferStream {
     ALuint mFrequency{0};
     ALuint mFrameSize{0};
 
-    Vector<ALbyte> mData;
     ALbyte mSilence{0};
 
     struct BufferLengthPair { ALuint mId; ALsizei mFrameLength; };
@@ -41,36 +46,164 @@ class ALBufferStream {
     bool mHasLooped{false};
     std::atomic<bool> mDone{false};
 
+    // Callback streaming. The mixer pulls frames from the decode-ahead ring
+    // through a single callback buffer, and the position comes from what it
+    // was given. The mutex keeps the ring from being reset under it.
+    bool mCallback{false};
+    std::mutex mCallbackMutex;
+    ALsizei mChunkOffset{0};
+    std::atomic<uint64_t> mDeliveredPos{0};
+    std::atomic<uint64_t> mStarvedFrames{0};
+
+    // Seek requests for the background thread. Each request bumps the
+    // generation, and only the latest target is acted on.
+    std::atomic<uint64_t> mSeekTarget{0};
+    std::atomic<uint64_t> mSeekRequested{0};
+    uint64_t mSeekHandled{0};
+
+    std::chrono::milliseconds mMinLatency{0};
+    std::chrono::milliseconds mMaxLatency{0};
+
+    // Adaptive queue sizing. The number of chunks kept queued, out of the
+    // mBuffers ring, varies between the min and max depth.
+    std::atomic<ALsizei> mQueueDepth{0};
+    ALsizei mMinDepth{0}, mMaxDepth{0};
+    bool mAdaptive{false};
+    std::chrono::steady_clock::time_point mLastRefill;
+    std::chrono::steady_clock::time_point mCalmSince;
+
 public:
-    ALBufferStream(SharedPtr<Decoder> decoder, ALsizei updatelen, ALsizei numupdates)
-      : mDecoder(decoder), mUpdateLen(updatelen), mNumUpdates(numupdates)
+    ALBufferStream(ContextImpl &context, SharedPtr<Decoder> decoder, ALsizei updatelen,
+                   ALsizei numupdates)
+      : mContext(context), mDecoder(decoder), mUpdateLen(updatelen), mNumUpdates(numupdates)
+      , mCallback(context.getCallbackStreaming() &&
+                  context.hasExtension(AL::SOFT_callback_buffer))
     { }
     ~ALBufferStream()
     {
+        if(mIsAhead)
+            mContext.getDecodeWorker().remove(mAhead.get());
+        Vector<ALuint> ids;
+        ids.reserve(mBuffers.size());
         for(auto &buflen : mBuffers)
-            alDeleteBuffers(1, &buflen.mId);
+            ids.push_back(buflen.mId);
+        mContext.getStreamPool()->putBufferIds(ids.data(), static_cast<ALsizei>(ids.size()));
         mBuffers.clear();
     }
 
+    bool isCallback() const { return mCallback; }
+
     uint64_t getPosition() const { return mSamplePos; }
+    uint64_t getDeliveredPosition() const { return mDeliveredPos.load(std::memory_order_relaxed); }
+    uint64_t takeStarvedFrames() { return mStarvedFrames.exchange(0, std::memory_order_relaxed); }
     size_t getTotalBuffered() const { return mTotalBuffered; }
 
     ALsizei getNumUpdates() const { return mNumUpdates; }
     ALsizei getUpdateLength() const { return mUpdateLen; }
+    ALsizei getQueueDepth() const { return mQueueDepth.load(std::memory_order_relaxed); }
+
+    void setLatencyRange(std::chrono::milliseconds minlat, std::chrono::milliseconds maxlat)
+    {
+        mMinLatency = minlat;
+        mMaxLatency = maxlat;
+        mAdaptive = (maxlat.count() > 0);
+        if(!mAdaptive)
+        {
+            mMinDepth = mMaxDepth = mNumUpdates;
+            mQueueDepth.store(mNumUpdates, std::memory_order_relaxed);
+            return;
+        }
+
+        auto to_chunks = [this](std::chrono::milliseconds lat) -> ALsizei
+        {
+            uint64_t frames = static_cast<uint64_t>(lat.count()) * mFrequency / 1000;
+            return static_cast<ALsizei>(std::min<uint64_t>(
+                (frames + mUpdateLen-1) / mUpdateLen, mNumUpdates
+            ));
+        };
+        mMinDepth = std::max(to_chunks(minlat), 2);
+        mMaxDepth = std::max(to_chunks(maxlat), mMinDepth);
+        // Start at the most robust depth, and shrink once playback is calm.
+        mQueueDepth.store(mMaxDepth, std::memory_order_relaxed);
+        resetRefillClock();
+    }
+
+    // Starts timing refills afresh, when playback (re)starts. Otherwise the
+    // time spent paused or seeking looks like a late refill.
+    void resetRefillClock()
+    { mCalmSince = mLastRefill = std::chrono::steady_clock::now(); }
+
+    // Adjusts the queue depth given the number of chunks that were still
+    // queued when a refill was needed, or after an underrun. Only call this
+    // when chunks were actually refilled, so the time between calls is the
+    // time between refills.
+    void adaptQueue(ALint remaining, bool underrun)
+    {
+        if(!mAdaptive) return;
+
+        auto now = std::chrono::steady_clock::now();
+        auto interval = now - mLastRefill;
+        mLastRefill = now;
+
+        // The queue is about to run dry if what was left wouldn't last until
+        // another refill as late as the last one.
+        auto chunkdur = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            Seconds(static_cast<double>(mUpdateLen) / mFrequency));
+        ALsizei depth = mQueueDepth.load(std::memory_order_relaxed);
+        if(underrun || chunkdur*remaining < interval)
+        {
+            if(depth < mMaxDepth)
+                mQueueDepth.store(depth+1, std::memory_order_relaxed);
+            mCalmSince = now;
+        }
+        else if(now - mCalmSince >= std::chrono::seconds(4))
+        {
+            if(depth > mMinDepth)
+                mQueueDepth.store(depth-1, std::memory_order_relaxed);
+            mCalmSince = now;
+        }
+    }
 
     ALuint getFrequency() const { return mFrequency; }
 
+    void requestSeek(uint64_t pos)
+    {
+        mSeekTarget.store(pos, std::memory_order_relaxed);
+        mSeekRequested.fetch_add(1, std::memory_order_release);
+    }
+
+    // Gets the latest seek request, if there's one that hasn't been taken.
+    bool takeSeekRequest(uint64_t &pos)
+    {
+        uint64_t gen = mSeekRequested.load(std::memory_order_acquire);
+        if(gen == mSeekHandled)
+            return false;
+        mSeekHandled = gen;
+        pos = mSeekTarget.load(std::memory_order_relaxed);
+        return true;
+    }
+
     bool seek(uint64_t pos)
     {
-        if(!mDecoder->seek(pos))
+        std::lock_guard<std::mutex> lock(mCallbackMutex);
+        if(mPrerolled)
+        {
+            // Keep what was decoded in advance, if starting from it.
+            mPrerolled = false;
+            if(pos == 0) return true;
+        }
+        if(!mAhead->seek(pos))
             return false;
+        mChunkOffset = 0;
+        mDeliveredPos.store(pos, std::memory_order_relaxed);
         mSamplePos = pos;
         mHasLooped = false;
         mDone.store(false, std::memory_order_release);
         return true;
     }
 
-    void prepare()
+    // Sets up the format and decode-ahead ring for the current decoder.
+    void setupDecoder()
     {
         ALuint srate = mDecoder->getFrequency();
         ChannelConfig chans = mDecoder->getChannelConfig();
@@ -93,29 +226,131 @@ public:
             throw std::runtime_error(str);
         }
 
-        mData.resize(mUpdateLen * mFrameSize);
         if(type == SampleType::UInt8) mSilence = -128;
         else if(type == SampleType::Mulaw) mSilence = 127;
         else mSilence = 0;
 
-        mBuffers.assign(mNumUpdates, {0,0});
-        for(auto &buflen : mBuffers)
-            alGenBuffers(1, &buflen.mId);
+        // Hold enough chunks to cover the context's decode-ahead time. Without
+        // it, the chunks are decoded as they're queued, one at a time. The
+        // mixer can't decode for itself, so callback streams always decode
+        // ahead, at least as much as would otherwise be queued.
+        size_t numchunks = 1;
+        auto ahead = mContext.getStreamDecodeAhead();
+        if(ahead.count() > 0)
+        {
+            uint64_t frames = (static_cast<uint64_t>(ahead.count())*srate + 999) / 1000;
+            numchunks = std::max<uint64_t>(2, (frames + mUpdateLen-1) / mUpdateLen);
+            mIsAhead = true;
+        }
+        if(mCallback)
+        {
+            numchunks = std::max<size_t>(numchunks, mNumUpdates);
+            mIsAhead = true;
+        }
+
+        // Take over the ring of a prepared decoder, which has been decoding
+        // in the background already.
+        if(PreparedDecoder *prepared = PreparedDecoder::Get(mDecoder.get()))
+        {
+            if((mAhead=prepared->takeAhead(mUpdateLen)) != nullptr)
+            {
+                mIsAhead = true;
+                mPrerolled = true;
+                return;
+            }
+        }
+        mAhead = MakeShared<DecodeAhead>(mDecoder, mFrameSize, mUpdateLen, numchunks, mLoopPts,
+                                         mContext.getStreamPool());
+    }
+
+    void prepare()
+    {
+        setupDecoder();
+
+        Vector<ALuint> ids(mCallback ? 1 : mNumUpdates);
+        mContext.getStreamPool()->getBufferIds(ids.data(), static_cast<ALsizei>(ids.size()));
+        mBuffers.reserve(ids.size());
+        for(ALuint id : ids)
+            mBuffers.push_back({id, 0});
+        mQueueDepth.store(mNumUpdates, std::memory_order_relaxed);
+    }
+
+    // Queues a decoder to continue with after the current one.
+    void queueNext(SharedPtr<Decoder> decoder)
+    {
+        mAhead->queueNext(std::move(decoder));
+        if(mDone.load(std::memory_order_relaxed) && !mAhead->isFinished())
+            mDone.store(false, std::memory_order_release);
+    }
+
+    // Restarts the stream with the next queued decoder that couldn't be
+    // continued seamlessly, once the queue has played out. Returns false if
+    // there isn't one.
+    bool restartNext(ALuint srcid, bool looping)
+    {
+        std::deque<SharedPtr<Decoder>> next = mAhead->takeNext();
+        while(!next.empty())
+        {
+            if(mIsAhead)
+                mContext.getDecodeWorker().remove(mAhead.get());
+            mIsAhead = false;
+
+            mDecoder = std::move(next.front());
+            next.pop_front();
+            try {
+                std::lock_guard<std::mutex> lock(mCallbackMutex);
+                setupDecoder();
+            }
+            catch(std::exception&) {
+                // Skip decoders with an unsupported format.
+                continue;
+            }
+            for(auto &decoder : next)
+                mAhead->queueNext(std::move(decoder));
+            next.clear();
+
+            if(mAdaptive)
+                setLatencyRange(mMinLatency, mMaxLatency);
+            mSamplePos = 0;
+            mDeliveredPos.store(0, std::memory_order_relaxed);
+            mHasLooped = false;
+            mDone.store(false, std::memory_order_release);
+            alSourceRewind(srcid);
+            if(resetQueue(srcid, looping, getQueueDepth()) == 0)
+                return restartNext(srcid, looping);
+            startDecodeAhead();
+            return true;
+        }
+        return false;
+    }
+
+    // Hands the stream to the context's decode worker, which keeps decoding
+    // ahead of the queue from here on.
+    void startDecodeAhead()
+    {
+        if(mIsAhead)
+            mContext.getDecodeWorker().add(mAhead);
     }
 
     int64_t getLoopStart() const { return mLoopPts.first; }
     int64_t getLoopEnd() const { return mLoopPts.second; }
 
-    ALsizei resetQueue(ALuint srcid, bool looping)
+    // Requeues the source from the current position, with up to count chunks.
+    // Chunks are decoded here if needed.
+    ALsizei resetQueue(ALuint srcid, bool looping, ALsizei count)
     {
+        resetRefillClock();
         alSourcei(srcid, AL_BUFFER, 0);
         mTotalBuffered = 0;
         mReadIdx = mWriteIdx = 0;
+        mPrerolled = false;
+        if(mCallback)
+            return resetCallback(srcid, looping, count);
 
         ALsizei queued = 0;
-        for(;queued < mNumUpdates;queued++)
+        for(;queued < count;queued++)
         {
-            if(!streamMoreData(srcid, looping))
+            if(!streamMoreData(srcid, looping, true))
                 break;
         }
         return queued;
@@ -130,67 +365,111 @@ public:
         mReadIdx = (mReadIdx+1) % mBuffers.size();
     }
 
-    bool hasLooped() const { return mHasLooped; }
-    bool hasMoreData() const { return !mDone.load(std::memory_order_acquire); }
-    bool streamMoreData(ALuint srcid, bool loop)
+    // Sets the callback buffer on the source, after decoding up to count
+    // chunks. Returns the number of chunks ready.
+    ALsizei resetCallback(ALuint srcid, bool looping, ALsizei count)
     {
-        if(mDone.load(std::memory_order_acquire))
-            return false;
+        std::lock_guard<std::mutex> lock(mCallbackMutex);
+        mChunkOffset = 0;
+        mAhead->setLooping(looping);
+        while(mAhead->getReadyCount() < static_cast<size_t>(count) && mAhead->fill())
+        { }
 
-        ALsizei len = mUpdateLen;
-        if(loop && mSamplePos < mLoopPts.second)
-            len = static_cast<ALsizei>(std::min<uint64_t>(len, mLoopPts.second - mSamplePos));
-        else
-            loop = false;
+        ALsizei ready = static_cast<ALsizei>(mAhead->getReadyCount());
+        if(ready == 0)
+        {
+            mDone.store(true, std::memory_order_release);
+            return 0;
+        }
+        mContext.alBufferCallbackSOFT(mBuffers[0].mId, mFormat, mFrequency, CallbackFunc, this);
+        alSourcei(srcid, AL_BUFFER, mBuffers[0].mId);
+        return ready;
+    }
+
+    void setLooping(bool looping) { mAhead->setLooping(looping); }
+
+    static ALsizei AL_APIENTRY CallbackFunc(ALvoid *userptr, ALvoid *data, ALsizei size)
+    { return static_cast<ALBufferStream*>(userptr)->readCallback(static_cast<ALbyte*>(data), size); }
+
+    // Called by the mixer for more audio. Missing chunks are filled with
+    // silence, since a short return ends playback.
+    ALsizei readCallback(ALbyte *dst, ALsizei size)
+    {
+        const ALsizei frames = size / static_cast<ALsizei>(mFrameSize);
+        ALsizei done = 0;
 
-        ALsizei frames = mDecoder->read(mData.data(), len);
-        mSamplePos += frames;
-        if(loop && ((frames < mUpdateLen && mSamplePos > 0) || (mSamplePos == mLoopPts.second)))
+        std::unique_lock<std::mutex> lock(mCallbackMutex, std::try_to_lock);
+        if(lock.owns_lock())
         {
-            if(mSamplePos < mLoopPts.second)
+            DecodeAhead::Chunk chunk;
+            while(done < frames && mAhead->front(chunk))
             {
-                mLoopPts.second = mSamplePos;
-                if(mLoopPts.first >= mLoopPts.second)
-                    mLoopPts.first = 0;
-            }
-
-            do {
-                if(!mDecoder->seek(mLoopPts.first))
+                ALsizei todo = std::min(frames-done, chunk.mFrames-mChunkOffset);
+                memcpy(dst + done*mFrameSize, chunk.mData + mChunkOffset*mFrameSize,
+                       todo*mFrameSize);
+                done += todo;
+                mChunkOffset += todo;
+
+                // The chunk's remaining frames come before its end position,
+                // wrapping back around the loop if it looped in between.
+                uint64_t left = chunk.mFrames - mChunkOffset;
+                uint64_t pos = chunk.mEndPos - std::min(chunk.mEndPos, left);
+                if(chunk.mLooped && pos < chunk.mLoopPts.first)
+                    pos += chunk.mLoopPts.second - chunk.mLoopPts.first;
+                mDeliveredPos.store(pos, std::memory_order_relaxed);
+
+                if(mChunkOffset == chunk.mFrames)
                 {
-                    len = mUpdateLen-frames;
-                    if(len > 0)
-                    {
-                        ALuint got = mDecoder->read(&mData[frames*mFrameSize], len);
-                        mSamplePos += got;
-                        frames += got;
-                    }
-                    break;
+                    mChunkOffset = 0;
+                    mAhead->pop();
                 }
-                mSamplePos = mLoopPts.first;
-                mHasLooped = true;
-
-                len = static_cast<ALsizei>(
-                    std::min<uint64_t>(mUpdateLen-frames, mLoopPts.second-mLoopPts.first)
-                );
-                if(len == 0) break;
-                ALuint got = mDecoder->read(&mData[frames*mFrameSize], len);
-                if(got == 0) break;
-                mSamplePos += got;
-                frames += got;
-            } while(frames < mUpdateLen);
+            }
+            if(done < frames && mAhead->isFinished())
+            {
+                mDone.store(true, std::memory_order_release);
+                return done * mFrameSize;
+            }
+            if(done < frames)
+                mStarvedFrames.fetch_add(frames-done, std::memory_order_relaxed);
         }
-        if(frames < mUpdateLen)
+        memset(dst + done*mFrameSize, mSilence, (frames-done)*mFrameSize);
+        return size;
+    }
+
+    bool hasLooped() const { return mHasLooped; }
+    bool hasMoreData() const { return !mDone.load(std::memory_order_acquire); }
+    // Queues the next decoded chunk onto the source. Returns false if the
+    // stream is done, or a chunk isn't ready yet. With sync, or without
+    // decode-ahead, the chunk is decoded here if one isn't ready.
+    bool streamMoreData(ALuint srcid, bool loop, bool sync=false)
+    {
+        if(mDone.load(std::memory_order_acquire))
+            return false;
+
+        mAhead->setLooping(loop);
+        if((sync && mAhead->getReadyCount() == 0) || !mIsAhead)
+            mAhead->fill();
+
+        DecodeAhead::Chunk chunk;
+        if(!mAhead->front(chunk))
         {
-            mDone.store(true, std::memory_order_release);
-            if(frames == 0) return false;
+            if(mAhead->isFinished())
+                mDone.store(true, std::memory_order_release);
+            return false;
         }
 
         alBufferData(mBuffers[mWriteIdx].mId,
-            mFormat, mData.data(), frames * mFrameSize, mFrequency
+            mFormat, chunk.mData, chunk.mFrames * mFrameSize, mFrequency
         );
         alSourceQueueBuffers(srcid, 1, &mBuffers[mWriteIdx].mId);
-        mBuffers[mWriteIdx].mFrameLength = frames;
-        mTotalBuffered += frames;
+        mBuffers[mWriteIdx].mFrameLength = chunk.mFrames;
+        mTotalBuffered += chunk.mFrames;
+
+        mSamplePos = chunk.mEndPos;
+        mLoopPts = chunk.mLoopPts;
+        if(chunk.mNewTrack) mHasLooped = false;
+        if(chunk.mLooped) mHasLooped = true;
+        mAhead->pop();
 
         mWriteIdx = (mWriteIdx+1) % mBuffers.size();
         return true;
@@ -199,9 +478,11 @@ public:
 
 
 SourceImpl::SourceImpl(ContextImpl &context)
-  : mContext(context), mId(0), mBuffer(0), mGroup(nullptr), mIsAsync(false)
-  , mDirectFilter(AL_FILTER_NULL)
+  : mContext(context), mId(0), mBuffer(0), mGroup(nullptr), mIsAsync(false), mIsScheduled(false)
+  , mVirtualOffset(0), mVirtualTime(0)
+  , mProps(context.getSourceProps()), mPropIdx(mProps.add()), mDirectFilter(AL_FILTER_NULL)
 {
+    mListIdx.fill(InvalidListIdx);
     resetProperties();
     mEffectSlots.reserve(mContext.getDevice().getMaxAuxiliarySends());
 }
@@ -237,15 +518,12 @@ void SourceImpl::resetProperties()
     mFadeGain = 1.0f;
 
     mPaused.store(false, std::memory_order_release);
+    mUnderrunCount.store(0, std::memory_order_relaxed);
+    mUnderrunsPending.store(0, std::memory_order_relaxed);
+    mUnderrunGapPending.store(0, std::memory_order_relaxed);
     mOffset = 0;
     mPitch = 1.0f;
-    mGain = 1.0f;
-    mMinGain = 0.0f;
-    mMaxGain = 1.0f;
-    mRefDist = 1.0f;
-    mMaxDist = std::numeric_limits<float>::max();
-    mPosition = Vector3(0.0f);
-    mVelocity = Vector3(0.0f);
+    mProps.reset(mPropIdx);
     mDirection = Vector3(0.0f);
     mOrientation[0] = Vector3(0.0f, 0.0f, -1.0f);
     mOrientation[1] = Vector3(0.0f, 1.0f,  0.0f);
@@ -253,7 +531,6 @@ void SourceImpl::resetProperties()
     mConeOuterAngle = 360.0f;
     mConeOuterGain = 0.0f;
     mConeOuterGainHF = 1.0f;
-    mRolloffFactor = 1.0f;
     mRoomRolloffFactor = 0.0f;
     mDopplerFactor = 1.0f;
     mAirAbsorptionFactor = 0.0f;
@@ -264,7 +541,6 @@ void SourceImpl::resetProperties()
     mResampler = mContext.hasExtension(AL::SOFT_source_resampler) ?
                  alGetInteger(AL_DEFAULT_RESAMPLER_SOFT) : 0;
     mLooping = false;
-    mRelative = false;
     mDryGainHFAuto = true;
     mWetGainAuto = true;
     mWetGainHFAuto = true;
@@ -281,26 +557,32 @@ void SourceImpl::resetProperties()
     mEffectSlots.clear();
 
     mPriority = 0;
+    mMinStreamLatency = std::chrono::milliseconds::zero();
+    mMaxStreamLatency = std::chrono::milliseconds::zero();
+    mStreamChunkLen = 0;
+    mStreamQueueSize = 0;
 }
 
 void SourceImpl::applyProperties(bool looping) const
 {
     alSourcei(mId, AL_LOOPING, looping ? AL_TRUE : AL_FALSE);
     alSourcef(mId, AL_PITCH, mPitch * mGroupPitch);
-    alSourcef(mId, AL_GAIN, mGain * mGroupGain * mFadeGain);
-    alSourcef(mId, AL_MIN_GAIN, mMinGain);
-    alSourcef(mId, AL_MAX_GAIN, mMaxGain);
-    alSourcef(mId, AL_REFERENCE_DISTANCE, mRefDist);
-    alSourcef(mId, AL_MAX_DISTANCE, mMaxDist);
-    alSourcefv(mId, AL_POSITION, mPosition.getPtr());
-    alSourcefv(mId, AL_VELOCITY, mVelocity.getPtr());
+    alSourcef(mId, AL_GAIN, mProps.getGain(mPropIdx) * mGroupGain * mFadeGain);
+    auto gainrange = mProps.getGainRange(mPropIdx);
+    alSourcef(mId, AL_MIN_GAIN, gainrange.first);
+    alSourcef(mId, AL_MAX_GAIN, gainrange.second);
+    auto distrange = mProps.getDistanceRange(mPropIdx);
+    alSourcef(mId, AL_REFERENCE_DISTANCE, distrange.first);
+    alSourcef(mId, AL_MAX_DISTANCE, distrange.second);
+    alSourcefv(mId, AL_POSITION, mProps.getPosition(mPropIdx).getPtr());
+    alSourcefv(mId, AL_VELOCITY, mProps.getVelocity(mPropIdx).getPtr());
     alSourcefv(mId, AL_DIRECTION, mDirection.getPtr());
     if(mContext.hasExtension(AL::EXT_BFORMAT))
         alSourcefv(mId, AL_ORIENTATION, &mOrientation[0][0]);
     alSourcef(mId, AL_CONE_INNER_ANGLE, mConeInnerAngle);
     alSourcef(mId, AL_CONE_OUTER_ANGLE, mConeOuterAngle);
     alSourcef(mId, AL_CONE_OUTER_GAIN, mConeOuterGain);
-    alSourcef(mId, AL_ROLLOFF_FACTOR, mRolloffFactor);
+    alSourcef(mId, AL_ROLLOFF_FACTOR, mProps.getRolloffFactor(mPropIdx));
     alSourcef(mId, AL_DOPPLER_FACTOR, mDopplerFactor);
     if(mContext.hasExtension(AL::EXT_SOURCE_RADIUS))
         alSourcef(mId, AL_SOURCE_RADIUS, mRadius);
@@ -310,7 +592,7 @@ void SourceImpl::applyProperties(bool looping) const
         alSourcei(mId, AL_SOURCE_SPATIALIZE_SOFT, (ALint)mSpatialize);
     if(mContext.hasExtension(AL::SOFT_source_resampler))
         alSourcei(mId, AL_SOURCE_RESAMPLER_SOFT, mResampler);
-    alSourcei(mId, AL_SOURCE_RELATIVE, mRelative ? AL_TRUE : AL_FALSE);
+    alSourcei(mId, AL_SOURCE_RELATIVE, mProps.getRelative(mPropIdx) ? AL_TRUE : AL_FALSE);
     if(mContext.hasExtension(AL::EXT_EFX))
     {
         alSourcef(mId, AL_CONE_OUTER_GAINHF, mConeOuterGainHF);
@@ -337,30 +619,45 @@ void SourceImpl::unsetGroup()
 
 void SourceImpl::groupPropUpdate(ALfloat gain, ALfloat pitch)
 {
+    if(isVirtual())
+        rebaseVirtual();
     if(mId)
     {
         alSourcef(mId, AL_PITCH, mPitch * pitch);
-        alSourcef(mId, AL_GAIN, mGain * gain * mFadeGain);
+        alSourcef(mId, AL_GAIN, mProps.getGain(mPropIdx) * gain * mFadeGain);
     }
     mGroupPitch = pitch;
     mGroupGain = gain;
+    updateGainScale();
 }
 
 
 DECL_THUNK1(void, Source, play,, Buffer)
 void SourceImpl::play(Buffer buffer)
+{ playAt(std::move(buffer), std::chrono::nanoseconds::min()); }
+
+DECL_THUNK2(void, Source, playAt,, Buffer, std::chrono::nanoseconds)
+void SourceImpl::playAt(Buffer buffer, std::chrono::nanoseconds start_time)
 {
     BufferImpl *albuf = buffer.getHandle();
     if(!albuf) throw std::invalid_argument("Buffer is not valid");
     CheckContexts(mContext, albuf->getContext());
     CheckContext(mContext);
 
+    // A rejected play leaves whatever the source is currently doing intact.
+    if(UNLIKELY(albuf->hasInstancePolicy()) && !albuf->admitSource(this))
+        return;
+
     if(mStream)
         mContext.removeStream(this);
     mIsAsync.store(false, std::memory_order_release);
+    unschedule(true);
 
     if(mId == 0)
     {
+        // A culled source is still on the context's list of playing sources.
+        if(isVirtual())
+            mContext.removePlayingSource(this);
         mId = mContext.getSourceId(mPriority);
         applyProperties(mLooping);
     }
@@ -374,6 +671,7 @@ void SourceImpl::play(Buffer buffer)
     }
 
     mStream.reset();
+    mStreamChunkLen = mStreamQueueSize = 0;
     if(mBuffer)
         mBuffer->removeSource(Source(this));
     mBuffer = albuf;
@@ -383,7 +681,7 @@ void SourceImpl::play(Buffer buffer)
     alSourcei(mId, AL_SAMPLE_OFFSET,
         (ALuint)std::min<uint64_t>(mOffset, std::numeric_limits<ALint>::max()));
     mOffset = 0;
-    alSourcePlay(mId);
+    startPlayback(start_time);
     mPaused.store(false, std::memory_order_release);
     mContext.removePendingSource(this);
     mContext.addPlayingSource(this, mId);
@@ -391,6 +689,11 @@ void SourceImpl::play(Buffer buffer)
 
 DECL_THUNK3(void, Source, play,, SharedPtr<Decoder>, ALsizei, ALsizei)
 void SourceImpl::play(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei queue_size)
+{ playAt(std::move(decoder), chunk_len, queue_size, std::chrono::nanoseconds::min()); }
+
+DECL_THUNK4(void, Source, playAt,, SharedPtr<Decoder>, ALsizei, ALsizei, std::chrono::nanoseconds)
+void SourceImpl::playAt(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei queue_size,
+                        std::chrono::nanoseconds start_time)
 {
     if(chunk_len < 64)
         throw std::out_of_range("Update length out of range");
@@ -398,15 +701,19 @@ void SourceImpl::play(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei q
         throw std::out_of_range("Queue size out of range");
     CheckContext(mContext);
 
-    auto stream = MakeUnique<ALBufferStream>(decoder, chunk_len, queue_size);
+    auto stream = MakeUnique<ALBufferStream>(mContext, decoder, chunk_len, queue_size);
     stream->prepare();
+    stream->setLatencyRange(mMinStreamLatency, mMaxStreamLatency);
 
     if(mStream)
         mContext.removeStream(this);
     mIsAsync.store(false, std::memory_order_release);
+    unschedule(true);
 
     if(mId == 0)
     {
+        if(isVirtual())
+            mContext.removePlayingSource(this);
         mId = mContext.getSourceId(mPriority);
         applyProperties(false);
     }
@@ -425,17 +732,17 @@ void SourceImpl::play(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei q
     mBuffer = 0;
 
     mStream = std::move(stream);
+    mStreamChunkLen = chunk_len;
+    mStreamQueueSize = queue_size;
 
     mStream->seek(mOffset);
     mOffset = 0;
 
-    for(ALsizei i = 0;i < mStream->getNumUpdates();i++)
-    {
-        if(!mStream->streamMoreData(mId, mLooping))
-            break;
-    }
+    mStream->resetQueue(mId, mLooping, mStream->getQueueDepth());
+    mStream->startDecodeAhead();
+    mLastPlayingTime = std::chrono::steady_clock::now();
     alSourcei(mId, AL_SAMPLE_OFFSET, 0);
-    alSourcePlay(mId);
+    startPlayback(start_time);
     mPaused.store(false, std::memory_order_release);
 
     mContext.addStream(this);
@@ -460,6 +767,7 @@ void SourceImpl::play(SharedFuture<Buffer>&& future_buffer)
     mContext.removeFadingSource(this);
     mContext.removePlayingSource(this);
     makeStopped(true);
+    mStreamChunkLen = mStreamQueueSize = 0;
 
     mContext.addPendingSource(this, std::move(future_buffer));
 }
@@ -477,6 +785,7 @@ void SourceImpl::stop()
 
 void SourceImpl::makeStopped(bool dolock)
 {
+    unschedule(dolock);
     if(mStream)
     {
         if(dolock)
@@ -487,19 +796,9 @@ void SourceImpl::makeStopped(bool dolock)
     mIsAsync.store(false, std::memory_order_release);
 
     mFadeGain = 1.0f;
+    updateGainScale();
     if(mId != 0)
-    {
-        alSourceRewind(mId);
-        alSourcei(mId, AL_BUFFER, 0);
-        if(mContext.hasExtension(AL::EXT_EFX))
-        {
-            alSourcei(mId, AL_DIRECT_FILTER, AL_FILTER_NULL);
-            for(auto &i : mEffectSlots)
-                alSource3i(mId, AL_AUXILIARY_SEND_FILTER, 0, i.mSendIdx, AL_FILTER_NULL);
-        }
-        mContext.insertSourceId(mId);
-        mId = 0;
-    }
+        releaseId();
 
     mStream.reset();
     if(mBuffer)
@@ -510,6 +809,68 @@ void SourceImpl::makeStopped(bool dolock)
 }
 
 
+void SourceImpl::releaseId()
+{
+    alSourceRewind(mId);
+    alSourcei(mId, AL_BUFFER, 0);
+    if(mContext.hasExtension(AL::EXT_EFX))
+    {
+        alSourcei(mId, AL_DIRECT_FILTER, AL_FILTER_NULL);
+        for(auto &i : mEffectSlots)
+            alSource3i(mId, AL_AUXILIARY_SEND_FILTER, 0, i.mSendIdx, AL_FILTER_NULL);
+    }
+    mContext.insertSourceId(mId);
+    mId = 0;
+}
+
+
+void SourceImpl::startPlayback(std::chrono::nanoseconds start_time)
+{
+    DeviceImpl *device = mContext.getDevice().getHandle();
+    std::chrono::nanoseconds delay = std::chrono::nanoseconds::zero();
+    if(start_time != std::chrono::nanoseconds::min())
+        delay = start_time - device->getClockTime();
+
+    if(delay.count() <= 0)
+        alSourcePlay(mId);
+    else if(mContext.hasExtension(AL::SOFT_source_start_delay) &&
+            device->hasExtension(ALC::SOFT_device_clock))
+    {
+        // Map the start time onto the device's own clock, and let it start
+        // the source at that sample.
+        ALCint64SOFT devtime = 0;
+        device->alcGetInteger64vSOFT(device->getALCdevice(), ALC_DEVICE_CLOCK_SOFT, 1, &devtime);
+        mContext.alSourcePlayAtTimeSOFT(mId, devtime + delay.count());
+    }
+    else
+    {
+        mIsScheduled.store(true, std::memory_order_release);
+        mContext.addScheduledSource(this, std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay));
+    }
+}
+
+void SourceImpl::unschedule(bool dolock)
+{
+    if(!mIsScheduled.load(std::memory_order_acquire))
+        return;
+    if(dolock)
+        mContext.removeScheduledSource(this);
+    else
+        mContext.removeScheduledSourceNoLock(this);
+    mIsScheduled.store(false, std::memory_order_release);
+}
+
+void SourceImpl::startScheduled()
+{
+    // Clear the flag after starting, so anything that sees it unset also sees
+    // the source playing.
+    if(mStream) mStream->resetRefillClock();
+    alSourcePlay(mId);
+    mIsScheduled.store(false, std::memory_order_release);
+}
+
+
 DECL_THUNK2(void, Source, fadeOutToStop,, ALfloat, std::chrono::milliseconds)
 void SourceImpl::fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration)
 {
@@ -519,16 +880,79 @@ void SourceImpl::fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration)
         throw std::out_of_range("Fade duration out of range");
     CheckContext(mContext);
 
-    gain = std::max<ALfloat>(gain, 0.0001f);
-    float mult = std::pow(gain, float(1.0/Seconds(duration).count()));
+    startFade(gain, mContext.getDevice().getHandle()->getClockTime(), duration,
+              FadeShape::Exponential, true);
+}
+
+DECL_THUNK3(void, Source, fadeTo,, ALfloat, std::chrono::milliseconds, FadeShape)
+void SourceImpl::fadeTo(ALfloat gain, std::chrono::milliseconds duration, FadeShape shape)
+{
+    if(!(gain <= 1.0f && gain >= 0.0f))
+        throw std::out_of_range("Fade gain target out of range");
+    if(duration.count() <= 0)
+        throw std::out_of_range("Fade duration out of range");
+    CheckContext(mContext);
+
+    startFade(gain, mContext.getDevice().getHandle()->getClockTime(), duration, shape, false);
+}
+
+DECL_THUNK2(void, Source, fadeIn,, std::chrono::milliseconds, FadeShape)
+void SourceImpl::fadeIn(std::chrono::milliseconds duration, FadeShape shape)
+{
+    if(duration.count() <= 0)
+        throw std::out_of_range("Fade duration out of range");
+    CheckContext(mContext);
+
+    setFadeGain(0.0f);
+    startFade(1.0f, mContext.getDevice().getHandle()->getClockTime(), duration, shape, false);
+}
+
+DECL_THUNK3(void, Source, crossfadeTo,, Source, std::chrono::milliseconds, FadeShape)
+void SourceImpl::crossfadeTo(Source other, std::chrono::milliseconds duration, FadeShape shape)
+{
+    SourceImpl *target = other.getHandle();
+    if(!target) throw std::invalid_argument("Source is not valid");
+    if(target == this) throw std::invalid_argument("Cannot crossfade a source to itself");
+    if(duration.count() <= 0)
+        throw std::out_of_range("Fade duration out of range");
+    CheckContexts(mContext, target->mContext);
+    CheckContext(mContext);
+
+    // Start both fades at the same time, so their gains stay in step.
+    auto now = mContext.getDevice().getHandle()->getClockTime();
+    target->setFadeGain(0.0f);
+    target->startFade(1.0f, now, duration, shape, false);
+    startFade(0.0f, now, duration, shape, true);
+}
 
-    mContext.addFadingSource(this, duration, mult);
+void SourceImpl::startFade(ALfloat gain, std::chrono::nanoseconds start_time,
+                           std::chrono::milliseconds duration, FadeShape shape, bool stop_at_end)
+{
+    mContext.addFadingSource(MakeFadeEntry(this, mFadeGain, gain, start_time, duration, shape,
+                                           stop_at_end));
+}
+
+void SourceImpl::setFadeGain(ALfloat gain)
+{
+    mFadeGain = gain;
+    updateGainScale();
+    if(mId != 0)
+        alSourcef(mId, AL_GAIN, mProps.getGain(mPropIdx) * mGroupGain * mFadeGain);
 }
 
 
 void SourceImpl::checkPaused()
 {
-    if(mPaused.load(std::memory_order_acquire) || mId == 0)
+    if(mPaused.load(std::memory_order_acquire))
+        return;
+    if(isVirtual())
+    {
+        // The group paused its sources, so stop advancing this one too.
+        mVirtualOffset = getVirtualOffset();
+        mPaused.store(true, std::memory_order_release);
+        return;
+    }
+    if(mId == 0)
         return;
 
     ALint state = -1;
@@ -538,6 +962,13 @@ void SourceImpl::checkPaused()
                   std::memory_order_release);
 }
 
+void SourceImpl::unsetPaused()
+{
+    if(isVirtual() && mPaused.load(std::memory_order_acquire))
+        mVirtualTime = mContext.getDevice().getHandle()->getClockTime();
+    mPaused = false;
+}
+
 DECL_THUNK0(void, Source, pause,)
 void SourceImpl::pause()
 {
@@ -545,7 +976,27 @@ void SourceImpl::pause()
     if(mPaused.load(std::memory_order_acquire))
         return;
 
-    if(mId != 0)
+    if(mIsScheduled.load(std::memory_order_acquire))
+    {
+        // Pausing a source that's waiting to start cancels the start, leaving
+        // it paused at the beginning. The background thread may start it in
+        // the meantime, so check and remove it together under the lock. If
+        // it already started, pause it like normal.
+        auto lock = mContext.getSourceStreamLock();
+        if(mContext.removeScheduledSourceNoLock(this))
+        {
+            mIsScheduled.store(false, std::memory_order_release);
+            mPaused.store(true, std::memory_order_release);
+            return;
+        }
+    }
+
+    if(isVirtual())
+    {
+        mVirtualOffset = getVirtualOffset();
+        mPaused.store(true, std::memory_order_release);
+    }
+    else if(mId != 0)
     {
         std::lock_guard<std::mutex> lock(mMutex);
         alSourcePause(mId);
@@ -564,8 +1015,15 @@ void SourceImpl::resume()
     if(!mPaused.load(std::memory_order_acquire))
         return;
 
+    if(mStream)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStream->resetRefillClock();
+    }
     if(mId != 0)
         alSourcePlay(mId);
+    else if(isVirtual())
+        mVirtualTime = mContext.getDevice().getHandle()->getClockTime();
     mPaused.store(false, std::memory_order_release);
 }
 
@@ -581,7 +1039,9 @@ DECL_THUNK0(bool, Source, isPlaying, const)
 bool SourceImpl::isPlaying() const
 {
     CheckContext(mContext);
-    if(mId == 0) return false;
+    if(mId == 0) return isVirtual() && !mPaused.load(std::memory_order_acquire);
+    if(mIsScheduled.load(std::memory_order_acquire))
+        return true;
 
     ALint state = -1;
     alGetSourcei(mId, AL_SOURCE_STATE, &state);
@@ -596,7 +1056,7 @@ DECL_THUNK0(bool, Source, isPaused, const)
 bool SourceImpl::isPaused() const
 {
     CheckContext(mContext);
-    return mId != 0 && mPaused.load(std::memory_order_acquire);
+    return (mId != 0 || isVirtual()) && mPaused.load(std::memory_order_acquire);
 }
 
 DECL_THUNK0(bool, Source, isPlayingOrPending, const)
@@ -605,7 +1065,11 @@ bool SourceImpl::isPlayingOrPending() const
     CheckContext(mContext);
 
     bool playing = false;
-    if(mId != 0)
+    if(mIsScheduled.load(std::memory_order_acquire))
+        playing = true;
+    else if(isVirtual())
+        playing = !mPaused.load(std::memory_order_acquire);
+    else if(mId != 0)
     {
         ALint state = -1;
         alGetSourcei(mId, AL_SOURCE_STATE, &state);
@@ -642,11 +1106,12 @@ void SourceImpl::setGroup(SourceGroup group)
         mGroupPitch = 1.0f;
         mGroupGain = 1.0f;
     }
+    updateGainScale();
 
     if(mId)
     {
         alSourcef(mId, AL_PITCH, mPitch * mGroupPitch);
-        alSourcef(mId, AL_GAIN, mGain * mGroupGain * mFadeGain);
+        alSourcef(mId, AL_GAIN, mProps.getGain(mPropIdx) * mGroupGain * mFadeGain);
     }
 }
 
@@ -659,6 +1124,8 @@ bool SourceImpl::checkPending(SharedFuture<Buffer> &future)
     BufferImpl *buffer = future.get().getHandle();
     if(UNLIKELY(!buffer || &(buffer->getContext()) != &mContext))
         return false;
+    if(UNLIKELY(buffer->hasInstancePolicy()) && !buffer->admitSource(this))
+        return false;
 
     if(mId == 0)
     {
@@ -685,37 +1152,26 @@ bool SourceImpl::checkPending(SharedFuture<Buffer> &future)
     return false;
 }
 
-bool SourceImpl::fadeUpdate(std::chrono::nanoseconds cur_fade_time, SourceFadeUpdateEntry &fade)
+bool SourceImpl::fadeUpdate(const SourceFadeUpdateEntry &fade, ALfloat gain, bool done)
 {
-    std::chrono::nanoseconds duration = cur_fade_time - fade.mFadeTimeStart;
-    if(duration.count() < 0) return true;
-    std::chrono::nanoseconds dur_total = fade.mFadeTimeTarget - fade.mFadeTimeStart;
-
-    if(duration >= dur_total)
+    if(done && fade.mStopAtEnd)
     {
-        mFadeGain = 1.0f;
-        if(!fade.mIsFadeOut)
-        {
-            if(mId != 0)
-                alSourcef(mId, AL_GAIN, mGain * mGroupGain);
-            return false;
-        }
         mContext.removePendingSource(this);
         mContext.removePlayingSource(this);
         makeStopped(true);
         return false;
     }
 
-    if(!fade.mIsFadeOut) duration = dur_total - duration;
-    mFadeGain = std::pow(fade.mFadeGainMult, float(Seconds(duration).count()));
-
-    if(mId != 0)
-        alSourcef(mId, AL_GAIN, mGain * mGroupGain * mFadeGain);
-    return true;
+    if(gain != mFadeGain)
+        setFadeGain(gain);
+    return !done;
 }
 
 bool SourceImpl::playUpdate(ALuint id)
 {
+    if(mIsScheduled.load(std::memory_order_acquire))
+        return true;
+
     ALint state = -1;
     alGetSourcei(id, AL_SOURCE_STATE, &state);
     if(LIKELY(state == AL_PLAYING || state == AL_PAUSED))
@@ -726,8 +1182,22 @@ bool SourceImpl::playUpdate(ALuint id)
     return false;
 }
 
+// Whether the source's buffer has played to the end, but the context hasn't
+// reaped it with playUpdate yet.
+bool SourceImpl::hasFinished() const
+{
+    if(mId == 0 || mIsScheduled.load(std::memory_order_acquire))
+        return false;
+
+    ALint state = -1;
+    alGetSourcei(mId, AL_SOURCE_STATE, &state);
+    return state != AL_PLAYING && state != AL_PAUSED;
+}
+
 bool SourceImpl::playUpdate()
 {
+    if(UNLIKELY(mUnderrunsPending.load(std::memory_order_acquire) > 0))
+        reportUnderruns();
     if(LIKELY(mIsAsync.load(std::memory_order_acquire)))
         return true;
 
@@ -737,45 +1207,208 @@ bool SourceImpl::playUpdate()
 }
 
 
+bool SourceImpl::canVirtualize() const
+{
+    // Only looping buffer sources are culled, since they'd otherwise keep
+    // their voice indefinitely and their position is easy to follow.
+    return mLooping && mBuffer && !mStream && mId != 0 &&
+           !mPaused.load(std::memory_order_acquire) &&
+           !mIsScheduled.load(std::memory_order_acquire);
+}
+
+void SourceImpl::makeVirtual()
+{
+    ALint srcpos = 0;
+    alGetSourcei(mId, AL_SAMPLE_OFFSET, &srcpos);
+    mVirtualOffset = srcpos;
+    mVirtualTime = mContext.getDevice().getHandle()->getClockTime();
+    releaseId();
+}
+
+uint64_t SourceImpl::getVirtualOffset() const
+{
+    if(mPaused.load(std::memory_order_acquire))
+        return mVirtualOffset;
+
+    auto elapsed = mContext.getDevice().getHandle()->getClockTime() - mVirtualTime;
+    uint64_t pos = mVirtualOffset + static_cast<uint64_t>(std::max(0.0,
+        Seconds(elapsed).count() * mBuffer->getFrequency() * mPitch * mGroupPitch
+    ));
+
+    ALuint length = mBuffer->getLength();
+    if(!mLooping || pos < length)
+        return pos;
+
+    // Wrap past the end of the buffer back into the loop range. A looping
+    // buffer source keeps the whole buffer as its loop if the loop points
+    // aren't set.
+    auto looppts = mBuffer->getLoopPoints();
+    if(looppts.first >= looppts.second)
+        looppts = {0, length};
+    uint64_t looplen = looppts.second - looppts.first;
+    if(looplen == 0 || pos < looppts.second)
+        return std::min<uint64_t>(pos, length);
+    return looppts.first + (pos-looppts.first)%looplen;
+}
+
+void SourceImpl::rebaseVirtual()
+{
+    mVirtualOffset = getVirtualOffset();
+    mVirtualTime = mContext.getDevice().getHandle()->getClockTime();
+}
+
+bool SourceImpl::virtualUpdate(bool audible)
+{
+    uint64_t offset = getVirtualOffset();
+    if(!mLooping && offset >= mBuffer->getLength())
+    {
+        makeStopped();
+        mContext.send(&MessageHandler::sourceStopped, Source(this));
+        return false;
+    }
+    if(!audible || mPaused.load(std::memory_order_acquire))
+        return true;
+
+    try {
+        mId = mContext.getSourceId(mPriority);
+    }
+    catch(std::exception&) {
+        // No voice is available yet, so keep playing virtually.
+        return true;
+    }
+    applyProperties(mLooping);
+    alSourcei(mId, AL_BUFFER, mBuffer->getId());
+    alSourcei(mId, AL_SAMPLE_OFFSET,
+        (ALuint)std::min<uint64_t>(offset, std::numeric_limits<ALint>::max()));
+    alSourcePlay(mId);
+    mContext.addPlayingSource(this, mId);
+    return false;
+}
+
+
+void SourceImpl::addUnderrun(std::chrono::nanoseconds gap)
+{
+    mUnderrunGapPending.fetch_add(gap.count(), std::memory_order_relaxed);
+    mUnderrunCount.fetch_add(1, std::memory_order_relaxed);
+    mUnderrunsPending.fetch_add(1, std::memory_order_release);
+    mContext.addUnderrun();
+}
+
+void SourceImpl::reportUnderruns()
+{
+    mUnderrunsPending.exchange(0, std::memory_order_acquire);
+    std::chrono::nanoseconds gap{mUnderrunGapPending.exchange(0, std::memory_order_relaxed)};
+    mContext.send(&MessageHandler::streamUnderrun, Source(this), gap);
+}
+
+
 ALint SourceImpl::refillBufferStream()
 {
     ALint processed;
     alGetSourcei(mId, AL_BUFFERS_PROCESSED, &processed);
-    while(processed > 0)
-    {
+    for(ALint i = 0;i < processed;++i)
         mStream->popBuffer(mId);
-        --processed;
-    }
 
     ALint queued;
     alGetSourcei(mId, AL_BUFFERS_QUEUED, &queued);
-    for(;queued < mStream->getNumUpdates();queued++)
+    const ALint remaining = queued;
+    for(;queued < mStream->getQueueDepth();queued++)
     {
         if(!mStream->streamMoreData(mId, mLooping))
             break;
     }
 
+    // Only time actual refills, not every wake of the background thread.
+    if(processed > 0 && queued > remaining && !mPaused.load(std::memory_order_acquire))
+        mStream->adaptQueue(remaining, false);
+
     return queued;
 }
 
+bool SourceImpl::updateCallbackStream()
+{
+    uint64_t seekpos;
+    if(mStream->takeSeekRequest(seekpos))
+        seekStream(seekpos);
+    mStream->setLooping(mLooping);
+
+    // The mixer was given silence for the frames the ring didn't have.
+    uint64_t starved = mStream->takeStarvedFrames();
+    if(starved > 0 && !mPaused.load(std::memory_order_acquire))
+        addUnderrun(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Seconds(static_cast<double>(starved) / mStream->getFrequency())
+        ));
+
+    if(mStream->hasMoreData())
+        return true;
+
+    // Wait for the source to play out what it was given.
+    ALint state = -1;
+    alGetSourcei(mId, AL_SOURCE_STATE, &state);
+    if(state == AL_PLAYING || state == AL_PAUSED)
+        return true;
+
+    if(mStream->restartNext(mId, mLooping))
+    {
+        if(!mPaused.load(std::memory_order_acquire))
+            alSourcePlay(mId);
+        return true;
+    }
+    mIsAsync.store(false, std::memory_order_release);
+    return false;
+}
+
 bool SourceImpl::updateAsync()
 {
     std::lock_guard<std::mutex> lock(mMutex);
+    if(mStream->isCallback())
+        return updateCallbackStream();
+
+    uint64_t seekpos;
+    if(mStream->takeSeekRequest(seekpos))
+        seekStream(seekpos);
 
     ALint queued = refillBufferStream();
     if(queued == 0)
     {
-        mIsAsync.store(false, std::memory_order_release);
-        return false;
+        if(!mStream->hasMoreData())
+        {
+            // Continue with a queued decoder that has a different format, now
+            // that the previous one has played out.
+            if(mStream->restartNext(mId, mLooping))
+            {
+                if(!mPaused.load(std::memory_order_acquire))
+                    alSourcePlay(mId);
+                mLastPlayingTime = std::chrono::steady_clock::now();
+                return true;
+            }
+            mIsAsync.store(false, std::memory_order_release);
+            return false;
+        }
+        // The decoder hasn't caught up yet, so wait for more data.
+        return true;
     }
 
     ALint state = -1;
     alGetSourcei(mId, AL_SOURCE_STATE, &state);
+    auto now = std::chrono::steady_clock::now();
     if(!mPaused.load(std::memory_order_acquire))
     {
-        // Make sure the source is still playing if it's not paused.
-        if(state != AL_PLAYING)
+        // Make sure the source is still playing if it's not paused or waiting
+        // to start.
+        if(state != AL_PLAYING && !mIsScheduled.load(std::memory_order_acquire))
+        {
+            if(state == AL_STOPPED)
+            {
+                // It ran out of queued audio since it was last seen playing.
+                addUnderrun(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - mLastPlayingTime
+                ));
+                mStream->adaptQueue(queued, true);
+            }
             alSourcePlay(mId);
+        }
+        mLastPlayingTime = now;
     }
     else
     {
@@ -783,11 +1416,67 @@ bool SourceImpl::updateAsync()
         // paused.
         if(state == AL_STOPPED)
             alSourceRewind(mId);
+        mLastPlayingTime = now;
     }
     return true;
 }
 
 
+DECL_THUNK1(void, Source, queueNext,, SharedPtr<Decoder>)
+void SourceImpl::queueNext(SharedPtr<Decoder>&& decoder)
+{
+    if(!decoder) throw std::invalid_argument("Decoder is not valid");
+    CheckContext(mContext);
+    if(!mStream && mStreamChunkLen == 0)
+        throw std::runtime_error("Source is not streaming");
+
+    if(mStream)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if(mIsAsync.load(std::memory_order_acquire))
+        {
+            mStream->queueNext(std::move(decoder));
+            return;
+        }
+    }
+
+    // The stream already ended, and may have been cleaned up by an update, so
+    // start the decoder now with the same settings.
+    playAt(std::move(decoder), mStreamChunkLen, mStreamQueueSize,
+           std::chrono::nanoseconds::min());
+}
+
+
+DECL_THUNK2(void, Source, setStreamLatencyRange,, std::chrono::milliseconds, std::chrono::milliseconds)
+void SourceImpl::setStreamLatencyRange(std::chrono::milliseconds min_latency,
+                                       std::chrono::milliseconds max_latency)
+{
+    if(min_latency.count() < 0 || max_latency.count() < 0 ||
+       (max_latency.count() > 0 && min_latency > max_latency))
+        throw std::out_of_range("Stream latency range out of range");
+    CheckContext(mContext);
+
+    mMinStreamLatency = min_latency;
+    mMaxStreamLatency = max_latency;
+    if(mStream)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStream->setLatencyRange(min_latency, max_latency);
+    }
+}
+
+DECL_THUNK0(std::chrono::nanoseconds, Source, getStreamLatency, const)
+std::chrono::nanoseconds SourceImpl::getStreamLatency() const
+{
+    CheckContext(mContext);
+    if(!mStream) return std::chrono::nanoseconds::zero();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Seconds(
+        static_cast<double>(mStream->getQueueDepth()) * mStream->getUpdateLength() /
+        mStream->getFrequency()
+    ));
+}
+
+
 DECL_THUNK1(void, Source, setPriority,, ALuint)
 void SourceImpl::setPriority(ALuint priority)
 {
@@ -799,6 +1488,14 @@ DECL_THUNK1(void, Source, setOffset,, uint64_t)
 void SourceImpl::setOffset(uint64_t offset)
 {
     CheckContext(mContext);
+    if(isVirtual())
+    {
+        if(offset >= mBuffer->getLength())
+            throw std::out_of_range("Offset out of range");
+        mVirtualOffset = offset;
+        mVirtualTime = mContext.getDevice().getHandle()->getClockTime();
+        return;
+    }
     if(mId == 0)
     {
         mOffset = offset;
@@ -813,23 +1510,50 @@ void SourceImpl::setOffset(uint64_t offset)
         alSourcei(mId, AL_SAMPLE_OFFSET, (ALint)offset);
         throw_al_error("Failed to set offset");
     }
+    else if(mIsAsync.load(std::memory_order_acquire))
+    {
+        // Leave it to the background thread, so repeated seeks don't wait on
+        // the decoder. Requests it hasn't gotten to are replaced.
+        mStream->requestSeek(offset);
+        mContext.wakeBackground();
+    }
     else
     {
         std::lock_guard<std::mutex> lock(mMutex);
         if(!mStream->seek(offset))
             throw std::runtime_error("Failed to seek to offset");
         alSourceRewind(mId);
-        ALsizei queued = mStream->resetQueue(mId, mLooping);
+        ALsizei queued = mStream->resetQueue(mId, mLooping, mStream->getQueueDepth());
         if(queued > 0 && !mPaused.load(std::memory_order_acquire))
             alSourcePlay(mId);
     }
 }
 
+void SourceImpl::seekStream(uint64_t offset)
+{
+    // A failed seek leaves the stream playing where it was.
+    if(!mStream->seek(offset))
+        return;
+    alSourceRewind(mId);
+
+    // Start with just the first chunk at the new offset. The rest is queued
+    // as the decode worker catches up.
+    ALsizei queued = mStream->resetQueue(mId, mLooping, 1);
+    if(queued > 0 && !mPaused.load(std::memory_order_acquire))
+        alSourcePlay(mId);
+    mLastPlayingTime = std::chrono::steady_clock::now();
+}
+
 DECL_THUNK0(UInt64NSecPair, Source, getSampleOffsetLatency, const)
 std::pair<uint64_t,std::chrono::nanoseconds> SourceImpl::getSampleOffsetLatency() const
 {
     std::pair<uint64_t,std::chrono::nanoseconds> ret{0, std::chrono::nanoseconds::zero()};
     CheckContext(mContext);
+    if(isVirtual())
+    {
+        ret.first = getVirtualOffset();
+        return ret;
+    }
     if(mId == 0) return ret;
 
     if(mStream)
@@ -848,6 +1572,14 @@ std::pair<uint64_t,std::chrono::nanoseconds> SourceImpl::getSampleOffsetLatency(
             alGetSourcei(mId, AL_SAMPLE_OFFSET, &srcpos);
         alGetSourcei(mId, AL_SOURCE_STATE, &state);
 
+        // The mixer's own buffering isn't known for callback streams, so
+        // report how far it's been given audio.
+        if(mStream->isCallback())
+        {
+            ret.first = mStream->getDeliveredPosition();
+            return ret;
+        }
+
         int64_t streampos = mStream->getPosition();
         if(state != AL_STOPPED)
         {
@@ -891,6 +1623,11 @@ std::pair<Seconds,Seconds> SourceImpl::getSecOffsetLatency() const
 {
     std::pair<Seconds,Seconds> ret{Seconds::zero(), Seconds::zero()};
     CheckContext(mContext);
+    if(isVirtual())
+    {
+        ret.first = Seconds(static_cast<double>(getVirtualOffset()) / mBuffer->getFrequency());
+        return ret;
+    }
     if(mId == 0) return ret;
 
     if(mStream)
@@ -914,6 +1651,13 @@ std::pair<Seconds,Seconds> SourceImpl::getSecOffsetLatency() const
         }
         alGetSourcei(mId, AL_SOURCE_STATE, &state);
 
+        if(mStream->isCallback())
+        {
+            ret.first = Seconds(static_cast<double>(mStream->getDeliveredPosition()) /
+                                mStream->getFrequency());
+            return ret;
+        }
+
         ALdouble frac = 0.0;
         int64_t streampos = mStream->getPosition();
         if(state != AL_STOPPED)
@@ -964,6 +1708,8 @@ void SourceImpl::setLooping(bool looping)
 {
     CheckContext(mContext);
 
+    if(isVirtual())
+        rebaseVirtual();
     if(mId && !mStream)
         alSourcei(mId, AL_LOOPING, looping ? AL_TRUE : AL_FALSE);
     mLooping = looping;
@@ -976,6 +1722,8 @@ void SourceImpl::setPitch(ALfloat pitch)
     if(!(pitch > 0.0f))
         throw std::out_of_range("Pitch out of range");
     CheckContext(mContext);
+    if(isVirtual())
+        rebaseVirtual();
     if(mId != 0)
         alSourcef(mId, AL_PITCH, pitch * mGroupPitch);
     mPitch = pitch;
@@ -990,7 +1738,7 @@ void SourceImpl::setGain(ALfloat gain)
     CheckContext(mContext);
     if(mId != 0)
         alSourcef(mId, AL_GAIN, gain * mGroupGain * mFadeGain);
-    mGain = gain;
+    mProps.setGain(mPropIdx, gain);
 }
 
 DECL_THUNK2(void, Source, setGainRange,, ALfloat, ALfloat)
@@ -1004,8 +1752,7 @@ void SourceImpl::setGainRange(ALfloat mingain, ALfloat maxgain)
         alSourcef(mId, AL_MIN_GAIN, mingain);
         alSourcef(mId, AL_MAX_GAIN, maxgain);
     }
-    mMinGain = mingain;
-    mMaxGain = maxgain;
+    mProps.setGainRange(mPropIdx, mingain, maxgain);
 }
 
 
@@ -1020,8 +1767,7 @@ void SourceImpl::setDistanceRange(ALfloat refdist, ALfloat maxdist)
         alSourcef(mId, AL_REFERENCE_DISTANCE, refdist);
         alSourcef(mId, AL_MAX_DISTANCE, maxdist);
     }
-    mRefDist = refdist;
-    mMaxDist = maxdist;
+    mProps.setDistanceRange(mPropIdx, refdist, maxdist);
 }
 
 
@@ -1036,8 +1782,8 @@ void SourceImpl::set3DParameters(const Vector3 &position, const Vector3 &velocit
         alSourcefv(mId, AL_VELOCITY, velocity.getPtr());
         alSourcefv(mId, AL_DIRECTION, direction.getPtr());
     }
-    mPosition = position;
-    mVelocity = velocity;
+    mProps.setPosition(mPropIdx, position.getPtr());
+    mProps.setVelocity(mPropIdx, velocity.getPtr());
     mDirection = direction;
 }
 
@@ -1055,8 +1801,8 @@ void SourceImpl::set3DParameters(const Vector3 &position, const Vector3 &velocit
             alSourcefv(mId, AL_ORIENTATION, orientation.first.getPtr());
         alSourcefv(mId, AL_DIRECTION, orientation.first.getPtr());
     }
-    mPosition = position;
-    mVelocity = velocity;
+    mProps.setPosition(mPropIdx, position.getPtr());
+    mProps.setVelocity(mPropIdx, velocity.getPtr());
     mDirection = mOrientation[0] = orientation.first;
     mOrientation[1] = orientation.second;
 }
@@ -1068,7 +1814,7 @@ void SourceImpl::setPosition(const Vector3 &position)
     CheckContext(mContext);
     if(mId != 0)
         alSourcefv(mId, AL_POSITION, position.getPtr());
-    mPosition = position;
+    mProps.setPosition(mPropIdx, position.getPtr());
 }
 
 DECL_THUNK1(void, Source, setPosition,, const ALfloat*)
@@ -1077,9 +1823,7 @@ void SourceImpl::setPosition(const ALfloat *pos)
     CheckContext(mContext);
     if(mId != 0)
         alSourcefv(mId, AL_POSITION, pos);
-    mPosition[0] = pos[0];
-    mPosition[1] = pos[1];
-    mPosition[2] = pos[2];
+    mProps.setPosition(mPropIdx, pos);
 }
 
 DECL_THUNK1(void, Source, setVelocity,, const Vector3&)
@@ -1088,7 +1832,7 @@ void SourceImpl::setVelocity(const Vector3 &velocity)
     CheckContext(mContext);
     if(mId != 0)
         alSourcefv(mId, AL_VELOCITY, velocity.getPtr());
-    mVelocity = velocity;
+    mProps.setVelocity(mPropIdx, velocity.getPtr());
 }
 
 DECL_THUNK1(void, Source, setVelocity,, const ALfloat*)
@@ -1097,9 +1841,7 @@ void SourceImpl::setVelocity(const ALfloat *vel)
     CheckContext(mContext);
     if(mId != 0)
         alSourcefv(mId, AL_VELOCITY, vel);
-    mVelocity[0] = vel[0];
-    mVelocity[1] = vel[1];
-    mVelocity[2] = vel[2];
+    mProps.setVelocity(mPropIdx, vel);
 }
 
 DECL_THUNK1(void, Source, setDirection,, const Vector3&)
@@ -1218,7 +1960,7 @@ void SourceImpl::setRolloffFactors(ALfloat factor, ALfloat roomfactor)
         if(mContext.hasExtension(AL::EXT_EFX))
             alSourcef(mId, AL_ROOM_ROLLOFF_FACTOR, roomfactor);
     }
-    mRolloffFactor = factor;
+    mProps.setRolloffFactor(mPropIdx, factor);
     mRoomRolloffFactor = roomfactor;
 }
 
@@ -1239,7 +1981,7 @@ void SourceImpl::setRelative(bool relative)
     CheckContext(mContext);
     if(mId != 0)
         alSourcei(mId, AL_SOURCE_RELATIVE, relative ? AL_TRUE : AL_FALSE);
-    mRelative = relative;
+    mProps.setRelative(mPropIdx, relative);
 }
 
 DECL_THUNK1(void, Source, setRadius,, ALfloat)
@@ -1522,5 +2264,7 @@ DECL_THUNK0(Spatialize, Source, get3DSpatialize, const)
 DECL_THUNK0(ALsizei, Source, getResamplerIndex, const)
 DECL_THUNK0(ALfloat, Source, getAirAbsorptionFactor, const)
 DECL_THUNK0(BoolTriple, Source, getGainAuto, const)
+DECL_THUNK0(uint64_t, Source, getUnderrunCount, const)
+DECL_THUNK0(MillisecondsPair, Source, getStreamLatencyRange, const)
 
 }
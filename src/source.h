@@ -2,14 +2,32 @@
 #define SOURCE_H
 
 #include "main.h"
+#include "sourceprops.h"
+#include "fade.h"
 
 #include <atomic>
+#include <limits>
 #include <mutex>
 
 namespace alure {
 
 class ALBufferStream;
 
+// The context's update lists a source can be on. Each source tracks its
+// position in the lists it's on, so they can be found and removed in constant
+// time.
+enum class SourceList {
+    Pending,
+    Fading,
+    Playing,
+    Streaming,
+    Async,
+    Virtual,
+
+    LIST_MAX
+};
+static constexpr size_t InvalidListIdx = std::numeric_limits<size_t>::max();
+
 struct SendProps {
     ALuint mSendIdx;
     AuxiliaryEffectSlotImpl *mSlot{nullptr};
@@ -32,15 +50,6 @@ struct SourceStreamUpdateEntry {
     SourceImpl *mSource;
 };
 
-struct SourceFadeUpdateEntry {
-    SourceImpl *mSource;
-
-    std::chrono::nanoseconds mFadeTimeStart;
-    std::chrono::nanoseconds mFadeTimeTarget;
-    bool mIsFadeOut;
-    ALfloat mFadeGainMult;
-};
-
 
 class SourceImpl {
     ContextImpl &mContext;
@@ -59,18 +68,27 @@ class SourceImpl {
     std::atomic<bool> mIsAsync;
 
     std::atomic<bool> mPaused;
+    // Set while the background thread is waiting to start the source.
+    std::atomic<bool> mIsScheduled;
+    // Stream underrun tracking. The background thread detects underruns, and
+    // they're reported on the next update.
+    std::chrono::steady_clock::time_point mLastPlayingTime;
+    std::atomic<uint64_t> mUnderrunCount{0};
+    std::atomic<uint64_t> mUnderrunsPending{0};
+    std::atomic<int64_t> mUnderrunGapPending{0};
     uint64_t mOffset;
+    // While culled, the play position at the given device clock time.
+    uint64_t mVirtualOffset;
+    std::chrono::nanoseconds mVirtualTime;
     ALfloat mPitch;
-    ALfloat mGain;
-    ALfloat mMinGain, mMaxGain;
-    ALfloat mRefDist, mMaxDist;
-    Vector3 mPosition;
-    Vector3 mVelocity;
+    // Spatial and gain properties are kept in the context's property store.
+    SourcePropStore &mProps;
+    size_t mPropIdx;
     Vector3 mDirection;
     Vector3 mOrientation[2];
     ALfloat mConeInnerAngle, mConeOuterAngle;
     ALfloat mConeOuterGain, mConeOuterGainHF;
-    ALfloat mRolloffFactor, mRoomRolloffFactor;
+    ALfloat mRoomRolloffFactor;
     ALfloat mDopplerFactor;
     ALfloat mAirAbsorptionFactor;
     ALfloat mRadius;
@@ -78,7 +96,6 @@ class SourceImpl {
     Spatialize mSpatialize;
     ALsizei mResampler;
     bool mLooping : 1;
-    bool mRelative : 1;
     bool mDryGainHFAuto : 1;
     bool mWetGainAuto : 1;
     bool mWetGainHFAuto : 1;
@@ -88,10 +105,38 @@ class SourceImpl {
 
     ALuint mPriority;
 
+    std::chrono::milliseconds mMinStreamLatency{0};
+    std::chrono::milliseconds mMaxStreamLatency{0};
+
+    // The chunk length and queue size of the last stream played, for
+    // queueNext to start a decoder with after the stream ended. Zero if the
+    // source last played a buffer, or nothing.
+    ALsizei mStreamChunkLen{0};
+    ALsizei mStreamQueueSize{0};
+
+    Array<size_t,static_cast<size_t>(SourceList::LIST_MAX)> mListIdx;
+
     void resetProperties();
     void applyProperties(bool looping) const;
 
+    void updateGainScale() { mProps.setGainScale(mPropIdx, mGroupGain*mFadeGain); }
+
     ALint refillBufferStream();
+    bool updateCallbackStream();
+    void seekStream(uint64_t offset);
+    void addUnderrun(std::chrono::nanoseconds gap);
+    void reportUnderruns();
+
+    void releaseId();
+    uint64_t getVirtualOffset() const;
+    void rebaseVirtual();
+
+    void startFade(ALfloat gain, std::chrono::nanoseconds start_time,
+                   std::chrono::milliseconds duration, FadeShape shape, bool stop_at_end);
+    void setFadeGain(ALfloat gain);
+
+    void startPlayback(std::chrono::nanoseconds start_time);
+    void unschedule(bool dolock);
 
     void setFilterParams(ALuint &filterid, const FilterParams &params);
 
@@ -100,25 +145,46 @@ public:
     ~SourceImpl();
 
     ALuint getId() const { return mId; }
+    size_t getPropIndex() const { return mPropIdx; }
+
+    size_t getListIndex(SourceList list) const
+    { return mListIdx[static_cast<size_t>(list)]; }
+    void setListIndex(SourceList list, size_t idx)
+    { mListIdx[static_cast<size_t>(list)] = idx; }
 
     bool checkPending(SharedFuture<Buffer> &future);
-    bool fadeUpdate(std::chrono::nanoseconds cur_fade_time, SourceFadeUpdateEntry &fade);
+    bool fadeUpdate(const SourceFadeUpdateEntry &fade, ALfloat gain, bool done);
     bool playUpdate(ALuint id);
     bool playUpdate();
     bool updateAsync();
+    bool hasFinished() const;
+
+    bool isVirtual() const { return getListIndex(SourceList::Virtual) != InvalidListIdx; }
+    bool canVirtualize() const;
+    void makeVirtual();
+    bool virtualUpdate(bool audible);
 
     void unsetGroup();
     void groupPropUpdate(ALfloat gain, ALfloat pitch);
 
     void checkPaused();
-    void unsetPaused() { mPaused = false; }
+    void unsetPaused();
+
+    void startScheduled();
 
     void play(Buffer buffer);
     void play(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei queue_size);
     void play(SharedFuture<Buffer>&& future_buffer);
+    void playAt(Buffer buffer, std::chrono::nanoseconds start_time);
+    void playAt(SharedPtr<Decoder>&& decoder, ALsizei chunk_len, ALsizei queue_size,
+                std::chrono::nanoseconds start_time);
+    void queueNext(SharedPtr<Decoder>&& decoder);
     void stop();
     void makeStopped(bool dolock=true);
     void fadeOutToStop(ALfloat gain, std::chrono::milliseconds duration);
+    void fadeTo(ALfloat gain, std::chrono::milliseconds duration, FadeShape shape);
+    void fadeIn(std::chrono::milliseconds duration, FadeShape shape);
+    void crossfadeTo(Source other, std::chrono::milliseconds duration, FadeShape shape);
     void pause();
     void resume();
 
@@ -127,6 +193,14 @@ public:
     bool isPaused() const;
     bool isPlayingOrPending() const;
 
+    uint64_t getUnderrunCount() const { return mUnderrunCount.load(std::memory_order_relaxed); }
+
+    void setStreamLatencyRange(std::chrono::milliseconds min_latency,
+                               std::chrono::milliseconds max_latency);
+    std::pair<std::chrono::milliseconds,std::chrono::milliseconds> getStreamLatencyRange() const
+    { return {mMinStreamLatency, mMaxStreamLatency}; }
+    std::chrono::nanoseconds getStreamLatency() const;
+
     void setGroup(SourceGroup group);
     SourceGroup getGroup() const { return SourceGroup(mGroup); }
 
@@ -144,26 +218,26 @@ public:
     ALfloat getPitch() const { return mPitch; }
 
     void setGain(ALfloat gain);
-    ALfloat getGain() const { return mGain; }
+    ALfloat getGain() const { return mProps.getGain(mPropIdx); }
 
     void setGainRange(ALfloat mingain, ALfloat maxgain);
     std::pair<ALfloat,ALfloat> getGainRange() const
-    { return {mMinGain, mMaxGain}; }
+    { return mProps.getGainRange(mPropIdx); }
 
     void setDistanceRange(ALfloat refdist, ALfloat maxdist);
     std::pair<ALfloat,ALfloat> getDistanceRange() const
-    { return {mRefDist, mMaxDist}; }
+    { return mProps.getDistanceRange(mPropIdx); }
 
     void set3DParameters(const Vector3 &position, const Vector3 &velocity, const Vector3 &direction);
     void set3DParameters(const Vector3 &position, const Vector3 &velocity, const std::pair<Vector3,Vector3> &orientation);
 
     void setPosition(const Vector3 &position);
     void setPosition(const ALfloat *pos);
-    Vector3 getPosition() const { return mPosition; }
+    Vector3 getPosition() const { return mProps.getPosition(mPropIdx); }
 
     void setVelocity(const Vector3 &velocity);
     void setVelocity(const ALfloat *vel);
-    Vector3 getVelocity() const { return mVelocity; }
+    Vector3 getVelocity() const { return mProps.getVelocity(mPropIdx); }
 
     void setDirection(const Vector3 &direction);
     void setDirection(const ALfloat *dir);
@@ -185,13 +259,13 @@ public:
 
     void setRolloffFactors(ALfloat factor, ALfloat roomfactor=0.0f);
     std::pair<ALfloat,ALfloat> getRolloffFactors() const
-    { return {mRolloffFactor, mRoomRolloffFactor}; }
+    { return {mProps.getRolloffFactor(mPropIdx), mRoomRolloffFactor}; }
 
     void setDopplerFactor(ALfloat factor);
     ALfloat getDopplerFactor() const { return mDopplerFactor; }
 
     void setRelative(bool relative);
-    bool getRelative() const { return mRelative; }
+    bool getRelative() const { return mProps.getRelative(mPropIdx); }
 
     void setRadius(ALfloat radius);
     ALfloat getRadius() const { return mRadius; }
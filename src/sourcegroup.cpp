@@ -182,11 +182,10 @@ void SourceGroupImpl::pauseAll() const
     Vector<ALuint> sourceids;
     sourceids.reserve(16);
     collectPlayingSourceIds(sourceids);
+    // Culled sources have no ID, but still need their status updated.
     if(!sourceids.empty())
-    {
         alSourcePausev(static_cast<ALsizei>(sourceids.size()), sourceids.data());
-        updatePausedStatus();
-    }
+    updatePausedStatus();
     lock.unlock();
 }
 
@@ -195,7 +194,7 @@ void SourceGroupImpl::collectPausedSourceIds(Vector<ALuint> &sourceids) const
 {
     for(SourceImpl *alsrc : mSources)
     {
-        if(alsrc->isPaused())
+        if(alsrc->isPaused() && alsrc->getId() != 0)
             sourceids.push_back(alsrc->getId());
     }
     for(SourceGroupImpl *group : mSubGroups)
@@ -220,10 +219,8 @@ void SourceGroupImpl::resumeAll() const
     sourceids.reserve(16);
     collectPausedSourceIds(sourceids);
     if(!sourceids.empty())
-    {
         alSourcePlayv(static_cast<ALsizei>(sourceids.size()), sourceids.data());
-        updatePlayingStatus();
-    }
+    updatePlayingStatus();
     lock.unlock();
 }
 
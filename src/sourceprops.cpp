@@ -0,0 +1,175 @@
+
+#include "config.h"
+
+#include "sourceprops.h"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define HAVE_SSE_INTRINSICS
+#endif
+
+namespace {
+
+using alure::DistanceModel;
+
+bool IsClamped(DistanceModel model)
+{
+    return model == DistanceModel::InverseClamped || model == DistanceModel::LinearClamped ||
+           model == DistanceModel::ExponentClamped;
+}
+
+// Calculates the distance attenuation as specified for OpenAL's distance
+// models.
+ALfloat CalcAttenuation(DistanceModel model, ALfloat dist, ALfloat refdist, ALfloat maxdist,
+                        ALfloat rolloff)
+{
+    if(IsClamped(model) && maxdist >= refdist)
+        dist = std::min(std::max(dist, refdist), maxdist);
+
+    switch(model)
+    {
+        case DistanceModel::InverseClamped:
+        case DistanceModel::Inverse:
+            if(refdist > 0.0f)
+            {
+                ALfloat denom = refdist + rolloff*(dist-refdist);
+                if(denom > 0.0f) return refdist / denom;
+            }
+            break;
+
+        case DistanceModel::LinearClamped:
+        case DistanceModel::Linear:
+            if(maxdist != refdist)
+                return std::max(1.0f - rolloff*(dist-refdist)/(maxdist-refdist), 0.0f);
+            break;
+
+        case DistanceModel::ExponentClamped:
+        case DistanceModel::Exponent:
+            if(dist > 0.0f && refdist > 0.0f)
+                return std::pow(dist/refdist, -rolloff);
+            break;
+
+        case DistanceModel::None:
+            break;
+    }
+    return 1.0f;
+}
+
+#ifdef HAVE_SSE_INTRINSICS
+inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+{ return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+#endif
+
+} // namespace
+
+namespace alure {
+
+size_t SourcePropStore::add()
+{
+    size_t idx = mGain.size();
+    mPosX.push_back(0.0f); mPosY.push_back(0.0f); mPosZ.push_back(0.0f);
+    mVelX.push_back(0.0f); mVelY.push_back(0.0f); mVelZ.push_back(0.0f);
+    mGain.push_back(1.0f);
+    mGainScale.push_back(1.0f);
+    mMinGain.push_back(0.0f);
+    mMaxGain.push_back(1.0f);
+    mRefDist.push_back(1.0f);
+    mMaxDist.push_back(std::numeric_limits<float>::max());
+    mRolloff.push_back(1.0f);
+    mAbsolute.push_back(1.0f);
+    return idx;
+}
+
+void SourcePropStore::reset(size_t idx)
+{
+    mPosX[idx] = mPosY[idx] = mPosZ[idx] = 0.0f;
+    mVelX[idx] = mVelY[idx] = mVelZ[idx] = 0.0f;
+    mGain[idx] = 1.0f;
+    mGainScale[idx] = 1.0f;
+    mMinGain[idx] = 0.0f;
+    mMaxGain[idx] = 1.0f;
+    mRefDist[idx] = 1.0f;
+    mMaxDist[idx] = std::numeric_limits<float>::max();
+    mRolloff[idx] = 1.0f;
+    mAbsolute[idx] = 1.0f;
+}
+
+
+ALfloat SourcePropStore::calcGain(size_t idx, const Vector3 &listener, DistanceModel model) const
+{
+    ALfloat dx = mPosX[idx] - listener[0]*mAbsolute[idx];
+    ALfloat dy = mPosY[idx] - listener[1]*mAbsolute[idx];
+    ALfloat dz = mPosZ[idx] - listener[2]*mAbsolute[idx];
+    ALfloat dist = std::sqrt(dx*dx + dy*dy + dz*dz);
+
+    ALfloat gain = mGain[idx] * mGainScale[idx] *
+                   CalcAttenuation(model, dist, mRefDist[idx], mMaxDist[idx], mRolloff[idx]);
+    return std::min(std::max(gain, mMinGain[idx]), mMaxGain[idx]);
+}
+
+void SourcePropStore::calcGains(const Vector3 &listener, DistanceModel model, ALfloat *gains) const
+{
+    const size_t count = mGain.size();
+    size_t i = 0;
+#ifdef HAVE_SSE_INTRINSICS
+    // The exponent models need a vector pow, so they use the scalar path.
+    if(model != DistanceModel::Exponent && model != DistanceModel::ExponentClamped)
+    {
+        const bool clamped = IsClamped(model);
+        const __m128 lx = _mm_set1_ps(listener[0]);
+        const __m128 ly = _mm_set1_ps(listener[1]);
+        const __m128 lz = _mm_set1_ps(listener[2]);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for(;i+4 <= count;i += 4)
+        {
+            __m128 absf = _mm_loadu_ps(&mAbsolute[i]);
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(&mPosX[i]), _mm_mul_ps(lx, absf));
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(&mPosY[i]), _mm_mul_ps(ly, absf));
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(&mPosZ[i]), _mm_mul_ps(lz, absf));
+            __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx),
+                _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+
+            __m128 refdist = _mm_loadu_ps(&mRefDist[i]);
+            __m128 maxdist = _mm_loadu_ps(&mMaxDist[i]);
+            __m128 rolloff = _mm_loadu_ps(&mRolloff[i]);
+            if(clamped)
+            {
+                __m128 clampdist = _mm_min_ps(_mm_max_ps(dist, refdist), maxdist);
+                dist = Select(_mm_cmpge_ps(maxdist, refdist), clampdist, dist);
+            }
+
+            // Lanes with invalid parameters may calculate inf or nan, but are
+            // replaced with 1 as the scalar path does.
+            __m128 atten = one;
+            __m128 scaled = _mm_mul_ps(rolloff, _mm_sub_ps(dist, refdist));
+            if(model == DistanceModel::Inverse || model == DistanceModel::InverseClamped)
+            {
+                __m128 denom = _mm_add_ps(refdist, scaled);
+                __m128 valid = _mm_and_ps(_mm_cmpgt_ps(refdist, zero), _mm_cmpgt_ps(denom, zero));
+                atten = Select(valid, _mm_div_ps(refdist, denom), one);
+            }
+            else if(model == DistanceModel::Linear || model == DistanceModel::LinearClamped)
+            {
+                __m128 range = _mm_sub_ps(maxdist, refdist);
+                __m128 lin = _mm_max_ps(_mm_sub_ps(one, _mm_div_ps(scaled, range)), zero);
+                atten = Select(_mm_cmpneq_ps(range, zero), lin, one);
+            }
+
+            __m128 gain = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(&mGain[i]),
+                _mm_loadu_ps(&mGainScale[i])), atten);
+            gain = _mm_max_ps(gain, _mm_loadu_ps(&mMinGain[i]));
+            gain = _mm_min_ps(gain, _mm_loadu_ps(&mMaxGain[i]));
+            _mm_storeu_ps(&gains[i], gain);
+        }
+    }
+#endif
+    for(;i < count;++i)
+        gains[i] = calcGain(i, listener, model);
+}
+
+} // namespace alure
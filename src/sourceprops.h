@@ -0,0 +1,71 @@
+#ifndef SOURCEPROPS_H
+#define SOURCEPROPS_H
+
+#include "main.h"
+
+namespace alure {
+
+// Holds the spatial and gain properties of all of a context's sources as
+// separate arrays, so passes over the whole scene (audibility estimates,
+// culling, etc) touch contiguous memory. Each source owns one slot for its
+// lifetime.
+class SourcePropStore {
+    Vector<ALfloat> mPosX, mPosY, mPosZ;
+    Vector<ALfloat> mVelX, mVelY, mVelZ;
+    Vector<ALfloat> mGain;
+    // Gain applied on top of the source's own, from its group and fading.
+    Vector<ALfloat> mGainScale;
+    Vector<ALfloat> mMinGain, mMaxGain;
+    Vector<ALfloat> mRefDist, mMaxDist;
+    Vector<ALfloat> mRolloff;
+    // 1 for sources positioned in world space, 0 for listener-relative ones,
+    // so the relative position can be found without branching.
+    Vector<ALfloat> mAbsolute;
+
+public:
+    size_t add();
+    void reset(size_t idx);
+
+    size_t size() const { return mGain.size(); }
+
+    void setPosition(size_t idx, const ALfloat *pos)
+    { mPosX[idx] = pos[0]; mPosY[idx] = pos[1]; mPosZ[idx] = pos[2]; }
+    Vector3 getPosition(size_t idx) const
+    { return Vector3(mPosX[idx], mPosY[idx], mPosZ[idx]); }
+
+    void setVelocity(size_t idx, const ALfloat *vel)
+    { mVelX[idx] = vel[0]; mVelY[idx] = vel[1]; mVelZ[idx] = vel[2]; }
+    Vector3 getVelocity(size_t idx) const
+    { return Vector3(mVelX[idx], mVelY[idx], mVelZ[idx]); }
+
+    void setGain(size_t idx, ALfloat gain) { mGain[idx] = gain; }
+    ALfloat getGain(size_t idx) const { return mGain[idx]; }
+
+    void setGainScale(size_t idx, ALfloat scale) { mGainScale[idx] = scale; }
+
+    void setGainRange(size_t idx, ALfloat mingain, ALfloat maxgain)
+    { mMinGain[idx] = mingain; mMaxGain[idx] = maxgain; }
+    std::pair<ALfloat,ALfloat> getGainRange(size_t idx) const
+    { return {mMinGain[idx], mMaxGain[idx]}; }
+
+    void setDistanceRange(size_t idx, ALfloat refdist, ALfloat maxdist)
+    { mRefDist[idx] = refdist; mMaxDist[idx] = maxdist; }
+    std::pair<ALfloat,ALfloat> getDistanceRange(size_t idx) const
+    { return {mRefDist[idx], mMaxDist[idx]}; }
+
+    void setRolloffFactor(size_t idx, ALfloat factor) { mRolloff[idx] = factor; }
+    ALfloat getRolloffFactor(size_t idx) const { return mRolloff[idx]; }
+
+    void setRelative(size_t idx, bool relative) { mAbsolute[idx] = relative ? 0.0f : 1.0f; }
+    bool getRelative(size_t idx) const { return mAbsolute[idx] == 0.0f; }
+
+    // Estimates the gain of each source after distance attenuation, given the
+    // listener position and distance model. Cone and air absorption effects
+    // are ignored, so the estimate is never lower than the real gain.
+    void calcGains(const Vector3 &listener, DistanceModel model, ALfloat *gains) const;
+    ALfloat calcGain(size_t idx, const Vector3 &listener, DistanceModel model) const;
+};
+
+} // namespace alure
+
+#endif /* SOURCEPROPS_H */
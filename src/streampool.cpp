@@ -0,0 +1,82 @@
+
+#include "config.h"
+
+#include "streampool.h"
+
+#include <algorithm>
+
+namespace alure {
+
+namespace {
+
+// How much is kept for reuse. Anything returned past this is freed.
+constexpr size_t MaxPooledBuffers = 64;
+constexpr size_t MaxStagingPerSize = 4;
+
+} // namespace
+
+void StreamPool::getBufferIds(ALuint *ids, ALsizei count)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    ALsizei reused = static_cast<ALsizei>(std::min<size_t>(count, mBufferIds.size()));
+    std::copy(mBufferIds.end()-reused, mBufferIds.end(), ids);
+    mBufferIds.resize(mBufferIds.size() - reused);
+    lock.unlock();
+
+    if(reused < count)
+        alGenBuffers(count-reused, ids+reused);
+    mHits.fetch_add(reused, std::memory_order_relaxed);
+    mMisses.fetch_add(count-reused, std::memory_order_relaxed);
+}
+
+void StreamPool::putBufferIds(const ALuint *ids, ALsizei count)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    ALsizei kept = static_cast<ALsizei>(std::min<size_t>(
+        count, MaxPooledBuffers - std::min(MaxPooledBuffers, mBufferIds.size())
+    ));
+    mBufferIds.insert(mBufferIds.end(), ids, ids+kept);
+    lock.unlock();
+
+    if(kept < count)
+        alDeleteBuffers(count-kept, ids+kept);
+}
+
+void StreamPool::deleteBufferIds()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if(!mBufferIds.empty())
+        alDeleteBuffers(static_cast<ALsizei>(mBufferIds.size()), mBufferIds.data());
+    mBufferIds.clear();
+}
+
+Vector<ALbyte> StreamPool::getStaging(size_t size)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto iter = mStaging.find(size);
+    if(iter != mStaging.end() && !iter->second.empty())
+    {
+        Vector<ALbyte> data = std::move(iter->second.back());
+        iter->second.pop_back();
+        lock.unlock();
+
+        mHits.fetch_add(1, std::memory_order_relaxed);
+        return data;
+    }
+    lock.unlock();
+
+    mMisses.fetch_add(1, std::memory_order_relaxed);
+    return Vector<ALbyte>(size);
+}
+
+void StreamPool::putStaging(Vector<ALbyte>&& data)
+{
+    if(data.empty()) return;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto &blocks = mStaging[data.size()];
+    if(blocks.size() < MaxStagingPerSize)
+        blocks.push_back(std::move(data));
+}
+
+} // namespace alure
@@ -0,0 +1,38 @@
+#ifndef STREAMPOOL_H
+#define STREAMPOOL_H
+
+#include "main.h"
+
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+
+namespace alure {
+
+// Recycles the AL buffers and decode staging memory of a context's streams,
+// so starting and stopping streams doesn't keep creating and deleting them.
+// Staging blocks are matched by byte size. Blocks may be returned from any
+// thread, while buffers need the context to be current.
+class StreamPool {
+    std::mutex mMutex;
+    Vector<ALuint> mBufferIds;
+    std::unordered_map<size_t,Vector<Vector<ALbyte>>> mStaging;
+
+    std::atomic<uint64_t> mHits{0};
+    std::atomic<uint64_t> mMisses{0};
+
+public:
+    void getBufferIds(ALuint *ids, ALsizei count);
+    void putBufferIds(const ALuint *ids, ALsizei count);
+    void deleteBufferIds();
+
+    Vector<ALbyte> getStaging(size_t size);
+    void putStaging(Vector<ALbyte>&& data);
+
+    std::pair<uint64_t,uint64_t> getStats() const
+    { return {mHits.load(std::memory_order_relaxed), mMisses.load(std::memory_order_relaxed)}; }
+};
+
+} // namespace alure
+
+#endif /* STREAMPOOL_H */